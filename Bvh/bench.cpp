@@ -0,0 +1,202 @@
+//
+//  bench.cpp
+//  Bvh
+//
+//  Headless motion processing and throughput benchmark.
+//  Build without JGL/GL, e.g.  g++ -std=c++17 -O2 -fopenmp-simd -DSKIN_OMP_SIMD -fno-math-errno -pthread bench.cpp -o bvhbench
+//
+//  usage: bvhbench [-j threads] [-r repeats] [-s vertices] <file.bvh | directory> ...
+//  Every clip is parsed, then updateBone + update run over all of its frames.
+//  With more than one clip the batch is spread over the worker threads.
+//  -s also skins a synthetic mesh of that many vertices (LBS and DQS) with the first clip.
+//
+
+#define BVH_HEADLESS
+#include "bvh.hpp"
+#include "skinning.hpp"
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace fs = std::filesystem;
+typedef std::chrono::high_resolution_clock Clock;
+
+struct ClipStats {
+	std::string name;
+	size_t bytes = 0;
+	int frames = 0;
+	int bones = 0;
+	double parseSec = 0;
+	double poseSec = 0;
+	bool ok = false;
+};
+
+double seconds(Clock::time_point a, Clock::time_point b) {
+	return std::chrono::duration<double>(b - a).count();
+}
+
+ClipStats processClip(const std::string& fn, int repeats) {
+	ClipStats st;
+	st.name = fn;
+	std::error_code ec;
+	st.bytes = fs::file_size(fn, ec);
+	if( ec ) return st;
+
+	Body body;
+	body.verbose = false;
+	auto t0 = Clock::now();
+	if( !body.readBVH(fn) ) return st;
+	auto t1 = Clock::now();
+	st.parseSec = seconds(t0, t1);
+	st.frames = body.getNFrames();
+	st.bones = body.bones.size();
+	if( st.frames <= 0 || st.bones == 0 ) return st;
+
+	volatile float sink = 0;
+	t0 = Clock::now();
+	for( int r = 0; r < repeats; r++ ) {
+		for( int f = 0; f < st.frames; f++ ) {
+			body.updateBone(f);
+			body.update();
+		}
+		sink = sink + body.bones.back().gp.x;
+	}
+	t1 = Clock::now();
+	st.poseSec = seconds(t0, t1) / repeats;
+	st.ok = true;
+	return st;
+}
+
+void printStats(const ClipStats& st) {
+	if( !st.ok ) {
+		printf("%-40s  failed to load\n", st.name.c_str());
+		return;
+	}
+	printf("%-40s %8d frames %4d bones  parse %8.2f MB/s  %12.0f poses/s  %14.0f FK bones/s\n",
+		   fs::path(st.name).filename().string().c_str(), st.frames, st.bones,
+		   st.bytes / 1e6 / st.parseSec,
+		   st.frames / st.poseSec,
+		   double(st.frames) * st.bones / st.poseSec);
+}
+
+// Random mesh around the bind pose joints, four influences per vertex.
+void benchSkinning(const std::string& fn, int vertices, int threads) {
+	Body body;
+	body.verbose = false;
+	if( !body.readBVH(fn) ) return;
+	int nb = body.bones.size();
+	if( body.getNFrames() == 0 || nb == 0 ) return;
+	body.updateBone(0);
+	body.update();
+	Skinner skinner;
+	skinner.threads = threads;
+	skinner.bind(body);
+
+	SkinMesh mesh;
+	mesh.resize(vertices);
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> u(-1.f, 1.f);
+	for( int i = 0; i < vertices; i++ ) {
+		int b = rng() % nb;
+		glm::vec3 p = body.bones[b].gp + glm::vec3(u(rng), u(rng), u(rng)) * 5.f;
+		mesh.px[i] = p.x; mesh.py[i] = p.y; mesh.pz[i] = p.z;
+		mesh.ny[i] = 1;
+		for( int k = 0; k < SkinMesh::MAX_INFLUENCES; k++ ) {
+			mesh.bone[k][i] = k == 0 ? b : rng() % nb;
+			mesh.weight[k][i] = u(rng) + 1.f;
+		}
+	}
+	mesh.normalizeWeights();
+
+	SkinOutput out;
+	int frames = std::min(body.getNFrames(), 200);
+	for( int method = 0; method < 2; method++ ) {
+		auto t0 = Clock::now();
+		for( int f = 0; f < frames; f++ ) {
+			body.updateBone(f);
+			body.update();
+			skinner.setPose(body);
+			if( method == 0 ) skinner.skinLBS(mesh, out);
+			else skinner.skinDQS(mesh, out);
+		}
+		double sec = seconds(t0, Clock::now());
+		printf("%s skinning: %d vertices, %d frames, %.3f ms/frame, %.1f M vertices/s\n",
+			   method == 0 ? "LBS" : "DQS", vertices, frames, sec * 1e3 / frames, double(vertices) * frames / sec / 1e6);
+	}
+}
+
+int main(int argc, const char * argv[]) {
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	int repeats = 1;
+	int skinVertices = 0;
+	std::vector<std::string> files;
+	for( int i = 1; i < argc; i++ ) {
+		std::string a = argv[i];
+		if( a == "-j" && i+1 < argc ) threads = std::max(1, atoi(argv[++i]));
+		else if( a == "-r" && i+1 < argc ) repeats = std::max(1, atoi(argv[++i]));
+		else if( a == "-s" && i+1 < argc ) skinVertices = std::max(1, atoi(argv[++i]));
+		else if( fs::is_directory(a) ) {
+			for( auto& e : fs::recursive_directory_iterator(a) ) {
+				std::string ext = e.path().extension().string();
+				std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+				if( e.is_regular_file() && ext == ".bvh" ) files.push_back(e.path().string());
+			}
+		}
+		else files.push_back(a);
+	}
+	if( files.empty() ) {
+		fprintf(stderr, "usage: %s [-j threads] [-r repeats] [-s vertices] <file.bvh | directory> ...\n", argv[0]);
+		return 1;
+	}
+	std::sort(files.begin(), files.end());
+	if( skinVertices > 0 ) {
+		benchSkinning(files[0], skinVertices, threads);
+		printf("\n");
+	}
+	threads = std::min<int>(threads, files.size());
+
+	std::vector<ClipStats> stats(files.size());
+	std::atomic<int> next(0);
+	std::mutex printMtx;
+	auto t0 = Clock::now();
+	auto work = [&]() {
+		for( int i = next++; i < files.size(); i = next++ ) {
+			stats[i] = processClip(files[i], repeats);
+			std::lock_guard<std::mutex> lock(printMtx);
+			printStats(stats[i]);
+		}
+	};
+	std::vector<std::thread> pool;
+	for( int t = 1; t < threads; t++ ) pool.emplace_back(work);
+	work();
+	for( auto& t : pool ) t.join();
+	double wall = seconds(t0, Clock::now());
+
+	// per phase rates from the time spent in each phase, summed over the clips and threads
+	size_t bytes = 0;
+	double frames = 0, boneFrames = 0, parseSec = 0, poseSec = 0;
+	int loaded = 0;
+	for( auto& st : stats ) {
+		if( !st.ok ) continue;
+		loaded++;
+		bytes += st.bytes;
+		frames += double(st.frames) * repeats;
+		boneFrames += double(st.frames) * st.bones * repeats;
+		parseSec += st.parseSec;
+		poseSec += st.poseSec * repeats;
+	}
+	printf("\n%d/%zu clips, %d threads, %.3f s wall (%.3f s parsing, %.3f s posing, summed over threads)\n",
+		   loaded, files.size(), threads, wall, parseSec, poseSec);
+	if( loaded > 0 ) {
+		printf("batch:      %.2f MB/s, %.0f poses/s, %.0f FK bones/s (parse and pose, over wall time)\n",
+			   bytes / 1e6 / wall, frames / wall, boneFrames / wall);
+		printf("per thread: %.2f MB/s parsed, %.0f poses/s, %.0f FK bones/s\n",
+			   bytes / 1e6 / parseSec, frames / poseSec, boneFrames / poseSec);
+	}
+	return loaded == files.size() ? 0 : 2;
+}
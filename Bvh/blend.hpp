@@ -0,0 +1,178 @@
+#ifndef __BLEND_HPP__
+#define __BLEND_HPP__
+
+#include "bvh.hpp"
+#include <algorithm>
+
+// Layered pose pipeline on top of Bone::tr / Bone::ro.
+// All clips driving one Body must share its skeleton (same bone order).
+// Pose buffers come from a PoseArena that is reset once per frame, so after the
+// first frame evaluating a stack of layers does not touch the heap.
+
+struct Pose {
+	glm::vec3* tr = nullptr;
+	glm::quat* ro = nullptr;
+	int n = 0;
+};
+
+struct PoseArena {
+	std::vector<glm::vec3> trs;
+	std::vector<glm::quat> ros;
+	size_t used = 0;
+	size_t peak = 0;
+
+	// Call once per frame. Grows to the previous frame's peak so pointers stay valid within a frame.
+	void reset() {
+		if( trs.size() < peak ) {
+			trs.resize(peak);
+			ros.resize(peak);
+		}
+		used = 0;
+	}
+	Pose alloc(int n) {
+		Pose p;
+		p.n = n;
+		if( used + n > trs.size() ) { // first frame or more layers than before: spill to a private buffer
+			spill.emplace_back(n);
+			spillRo.emplace_back(n);
+			p.tr = spill.back().data();
+			p.ro = spillRo.back().data();
+		}
+		else {
+			p.tr = trs.data() + used;
+			p.ro = ros.data() + used;
+		}
+		used += n;
+		peak = std::max(peak, used);
+		return p;
+	}
+	void endFrame() {
+		spill.clear();
+		spillRo.clear();
+	}
+private:
+	std::vector<std::vector<glm::vec3>> spill;
+	std::vector<std::vector<glm::quat>> spillRo;
+};
+
+// Per bone weights in [0,1]. An empty mask means every bone.
+typedef std::vector<float> BoneMask;
+
+// Mask covering the subtree rooted at bone `root`. Relies on parents preceding children in Body::bones.
+inline BoneMask subtreeMask(const Body& body, int root, float weight = 1.f) {
+	BoneMask mask(body.bones.size(), 0.f);
+	if( root < 0 || root >= mask.size() ) return mask;
+	mask[root] = weight;
+	for( int b = root+1; b < body.bones.size(); b++ ) {
+		int p = body.bones[b].parent;
+		if( p >= 0 && mask[p] > 0 ) mask[b] = weight;
+	}
+	return mask;
+}
+
+// Samples a clip at time (seconds), interpolating between the two nearest frames.
+inline void sampleClip(const Body& clip, float time, Pose out) {
+	int n = std::min<int>(out.n, clip.bones.size());
+	if( clip.Nframe == 0 ) {
+		for( int b = 0; b < n; b++ ) {
+			out.tr[b] = clip.bones[b].tr;
+			out.ro[b] = glm::quat(1,0,0,0);
+		}
+		return;
+	}
+	float f = clip.framerate > 0 ? time / clip.framerate : 0.f;
+	f = glm::clamp(f, 0.f, float(clip.Nframe-1));
+	int f0 = int(f);
+	int f1 = std::min(f0+1, clip.Nframe-1);
+	float a = f - f0;
+	const float* v0 = clip.ValuesPerFrame[f0].data();
+	const float* v1 = clip.ValuesPerFrame[f1].data();
+	for( int b = 0; b < n; b++ ) {
+		const Bone& bone = clip.bones[b];
+		glm::vec3 t0 = bone.tr, t1 = bone.tr;
+		glm::quat q0, q1;
+		bone.pose(v0, t0, q0);
+		bone.pose(v1, t1, q1);
+		out.tr[b] = glm::mix(t0, t1, a);
+		out.ro[b] = glm::slerp(q0, q1, a);
+	}
+}
+
+struct PoseLayer {
+	enum class MODE {
+		OVERRIDE,	// blend toward the clip pose by weight
+		ADDITIVE,	// add the clip's motion relative to its reference frame
+	};
+	const Body* clip = nullptr;
+	float time = 0.f;
+	float weight = 1.f;
+	MODE mode = MODE::OVERRIDE;
+	const BoneMask* mask = nullptr;
+	int referenceFrame = 0;		// ADDITIVE only
+
+	float boneWeight(int b) const {
+		if( mask == nullptr || mask->empty() ) return weight;
+		return b < mask->size() ? weight * (*mask)[b] : 0.f;
+	}
+};
+
+// Sets up two override layers fading from `from` to `to` over duration seconds.
+inline void crossfade(PoseLayer& from, PoseLayer& to, float elapsed, float duration) {
+	float w = duration > 0 ? glm::clamp(elapsed / duration, 0.f, 1.f) : 1.f;
+	from.mode = to.mode = PoseLayer::MODE::OVERRIDE;
+	from.weight = 1.f;
+	to.weight = w;
+}
+
+struct PoseBlender {
+	PoseArena arena;
+
+	// Evaluates layers bottom to top and writes the result into body.bones[].tr/ro.
+	// Layers start from the bind pose (Bone::tr, identity rotation), so a masked or partly
+	// weighted first layer leaves the rest of the skeleton there. Call body.update() afterwards for FK.
+	void evaluate(const PoseLayer* layers, int nLayers, Body& body) {
+		arena.reset();
+		int n = body.bones.size();
+		Pose result = arena.alloc(n);
+		Pose layer = arena.alloc(n);
+		Pose ref = arena.alloc(n);
+
+		for( int b = 0; b < n; b++ ) {
+			result.tr[b] = body.bones[b].tr;
+			result.ro[b] = glm::quat(1,0,0,0);
+		}
+		for( int l = 0; l < nLayers; l++ ) {
+			const PoseLayer& L = layers[l];
+			if( L.clip == nullptr || L.weight <= 0 ) continue;
+			sampleClip(*L.clip, L.time, layer);
+			if( L.mode == PoseLayer::MODE::ADDITIVE ) {
+				sampleClip(*L.clip, L.referenceFrame * L.clip->framerate, ref);
+				for( int b = 0; b < n; b++ ) {
+					float w = L.boneWeight(b);
+					if( w <= 0 ) continue;
+					glm::quat d = inverse(ref.ro[b]) * layer.ro[b];
+					result.tr[b] += w * (layer.tr[b] - ref.tr[b]);
+					result.ro[b] = result.ro[b] * glm::slerp(glm::quat(1,0,0,0), d, w);
+				}
+			}
+			else {
+				for( int b = 0; b < n; b++ ) {
+					float w = L.boneWeight(b);
+					if( w <= 0 ) continue;
+					result.tr[b] = glm::mix(result.tr[b], layer.tr[b], w);
+					result.ro[b] = glm::slerp(result.ro[b], layer.ro[b], w);
+				}
+			}
+		}
+		for( int b = 0; b < n; b++ ) {
+			body.bones[b].tr = result.tr[b];
+			body.bones[b].ro = result.ro[b];
+		}
+		arena.endFrame();
+	}
+	void evaluate(const std::vector<PoseLayer>& layers, Body& body) {
+		evaluate(layers.data(), layers.size(), body);
+	}
+};
+
+#endif
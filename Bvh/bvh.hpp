@@ -6,8 +6,12 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <fstream>
+#include <cstdlib>
 #include <glm/gtx/quaternion.hpp>
+#ifndef BVH_HEADLESS // define to build without the GL drawing code, e.g. for command line tools
 #include "GLTools.hpp"
+#endif
 
 const float OFFSET_SCALE = 5.f;
 const float RADIAN(3.141592 / 180.f);
@@ -17,6 +21,19 @@ inline glm::vec3 rotate( const glm::quat& q, const glm::vec3& v ) {
 	return glm::vec3(tmp.x,tmp.y,tmp.z);
 }
 
+// Shortest rotation taking direction a onto direction b.
+inline glm::quat rotationBetween( const glm::vec3& a, const glm::vec3& b ) {
+	float la = glm::length(a), lb = glm::length(b);
+	if( la < 1e-6f || lb < 1e-6f ) return glm::quat(1,0,0,0);
+	glm::vec3 u = a / la, v = b / lb;
+	float c = glm::dot(u, v);
+	if( c < -0.9999f ) { // opposite: half turn about any perpendicular axis
+		glm::vec3 axis = glm::cross(u, std::abs(u.x) < 0.9f ? glm::vec3(1,0,0) : glm::vec3(0,1,0));
+		return glm::quat(0, glm::normalize(axis));
+	}
+	return glm::normalize(glm::quat(1 + c, glm::cross(u, v)));
+}
+
 struct Link {
 	enum class CHANNEL_TYPE {
 		X_POSITION,
@@ -36,10 +53,19 @@ struct Link {
 	glm::quat ro = glm::quat(1,0,0,0);
 
 	Link* parent = nullptr;
+	bool ownsChildren = true; // false for views built by Body::buildLinks
 	~Link() {
-		for( int i=0; i<children.size(); i++ )
-			delete children[i];
-		children.clear();
+		if( !ownsChildren ) return;
+		// iterative, so deep trees cannot overflow the call stack
+		std::vector<Link*> pending;
+		pending.swap(children);
+		while( !pending.empty() ) {
+			Link* l = pending.back();
+			pending.pop_back();
+			pending.insert(pending.end(), l->children.begin(), l->children.end());
+			l->children.clear();
+			delete l;
+		}
 	}
 	void addChild(Link* l) {
 		children.push_back(l);
@@ -50,46 +76,7 @@ struct Link {
 		for( auto child : children )
 			child->print(os, t+1);
 	}
-	static Link* readJoint(std::istream& is, Link* parent) {
-		Link* link = new Link();
-		std::string tmp;
-		int nChannels;
-		is >> link->name; 
-		is >> tmp; // {
-		is >> tmp; // OFFSET
-		is >> link->offset.x >> link->offset.y >> link->offset.z;
-		link->offset *= OFFSET_SCALE;
-		is >> tmp; // CHANNELS
-		is >> nChannels;
-		for(int i=0; i<nChannels; i++) {
-			is >> tmp;
-			if(tmp.compare("Xposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::X_POSITION);
-			else if(tmp.compare("Yposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Y_POSITION);
-			else if(tmp.compare("Zposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Z_POSITION);
-			else if(tmp.compare("Xrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::X_ROTATION);
-			else if(tmp.compare("Yrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Y_ROTATION);
-			else if(tmp.compare("Zrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Z_ROTATION);
-		}
-		while( true ) {
-			is >> tmp; // JOINT, End, or }
-			if(tmp.compare("JOINT")==0) link->addChild(readJoint(is,link));
-			else if(tmp.compare("End")==0) link->addChild(readEndSite(is,link));
-			else if(tmp.compare("}") ==0 ) break;
-		}
-		return link;
-	}
-	static Link* readEndSite(std::istream& is, Link* parent) {
-		Link* link = new Link();
-		std::string tmp;
-		is >> tmp; // Site
-		is >> link->name;
-		is >> tmp; // {
-		is >> tmp; // OFFSET
-		is >> link->offset.x >> link->offset.y >> link->offset.z;
-		link->offset *= OFFSET_SCALE;
-		is >> tmp; // }
-		return link;
-	}
+#ifndef BVH_HEADLESS
 	void draw(const glm::vec3& pp, const glm::quat& pq) {
 		glm::quat q = pq*ro;
 		glm::vec3 p = rotate( q, offset ) + pp +tr;
@@ -99,6 +86,7 @@ struct Link {
 		for( auto child: children )
 			child->draw(p, q);
 	}
+#endif
 };
 
 
@@ -121,54 +109,129 @@ struct Bone {
 	int dataOffset = 0;
 	glm::vec3 gp;
 	glm::quat gq;
+
+	// local transform of this bone for one frame of channel values; tr keeps its value on axes without a channel
+	void pose(const float* values, glm::vec3& tr, glm::quat& ro) const {
+		glm::quat q1 = {1,0,0,0};
+		for (int i = 0; i < channelTypes.size(); i++) {
+			float v = values[dataOffset + i];
+			if (channelTypes[i] == CHANNEL_TYPE::X_POSITION) {
+				tr.x = v * OFFSET_SCALE;
+			}
+			else if (channelTypes[i] == CHANNEL_TYPE::Y_POSITION) {
+				tr.y = v * OFFSET_SCALE;
+			}
+			else if (channelTypes[i] == CHANNEL_TYPE::Z_POSITION) {
+				tr.z = v * OFFSET_SCALE;
+			}
+			else if (channelTypes[i] == CHANNEL_TYPE::X_ROTATION) {
+				q1*=glm::exp(glm::quat(0, glm::vec3(v,0,0)*RADIAN / 2.f));
+			}
+			else if (channelTypes[i] == CHANNEL_TYPE::Y_ROTATION) {
+				q1*=glm::exp(glm::quat(0, glm::vec3(0,v,0)*RADIAN / 2.f));
+			}
+			else if (channelTypes[i] == CHANNEL_TYPE::Z_ROTATION) {
+				q1*=glm::exp(glm::quat(0, glm::vec3(0, 0, v) *RADIAN/ 2.f));
+			}
+		}
+		ro = q1;
+	}
 };
 
 struct Body {
 	std::vector<Bone> bones;
 	int Nframe = 0;
+	int Nchannel = 0;
 	float framerate = 0.f;
 	std::vector<std::vector<float>> ValuesPerFrame;
+	bool verbose = true; // print bone names and the motion header while reading
 
-	void readEndSite(std::istream& is, int parent ) {
-		bones.push_back(Bone());
-		Bone& bone = bones.back();
-		bone.parent = parent;
+	static bool fail( const std::string& msg ) {
+		std::cerr << "BVH: " << msg << std::endl;
+		return false;
+	}
+	static bool expect( std::istream& is, const char* token ) {
 		std::string tmp;
-		is >> tmp; // Site
-		is >> bone.name; std::cout<<bone.name<<std::endl;
-		if (bone.name.compare("{") != 0) {
-			is >> tmp; // {
-		}
-		is >> tmp; // OFFSET
-		is >> bone.offset.x >> bone.offset.y >> bone.offset.z;
-		bone.offset *= OFFSET_SCALE;
-		is >> tmp; // }
+		is >> tmp;
+		return tmp.compare(token) == 0 || fail(std::string("expected ") + token + ", found '" + tmp + "'");
+	}
+
+	// Drops the skeleton and the motion; verbose is kept.
+	void clear() {
+		bones.clear();
+		Nframe = 0;
+		Nchannel = 0;
+		framerate = 0.f;
+		ValuesPerFrame.clear();
 	}
 
-	void readBVH( const std::string& fn ) {
+	// On failure the Body is left empty.
+	bool readBVH( const std::string& fn ) {
 		std::ifstream is(fn);
-		std::stack<int> parent;
+		if( !is ) {
+			clear();
+			return fail("cannot open " + fn);
+		}
+		if( !readHierarchy(is) ) return false;
+		ValuesPerFrame.assign(Nframe, std::vector<float>(Nchannel));
+		if(verbose) std::cout << Nframe << " :"<<framerate << " :" << Nchannel << std::endl;
+		std::string line;
+		std::getline(is, line); // rest of the Frame Time line
+		int f = 0;
+		while( f < Nframe && std::getline(is, line) ) {
+			const char* p = line.c_str();
+			char* end;
+			int c = 0;
+			for( float v = std::strtof(p, &end); end != p; v = std::strtof(p, &end) ) {
+				if( c < Nchannel ) ValuesPerFrame[f][c] = v;
+				c++;
+				p = end;
+			}
+			if( c == 0 ) continue; // blank line
+			if( c != Nchannel ) {
+				fail(fn + ": frame " + std::to_string(f) + " has " + std::to_string(c) + " values, the hierarchy declares " + std::to_string(Nchannel) + " channels");
+				clear();
+				return false;
+			}
+			f++;
+		} // read value
+		if( f < Nframe ) {
+			fail(fn + ": expected " + std::to_string(Nframe) + " frames, found " + std::to_string(f));
+			Nframe = f;
+			ValuesPerFrame.resize(f);
+		}
+		return true;
+	}
+	// HIERARCHY and the MOTION header; leaves the stream at the end of the Frame Time line.
+	// On failure the Body is left empty.
+	bool readHierarchy( std::istream& is ) {
+		if( parseHierarchy(is) ) return true;
+		clear();
+		return false;
+	}
+private:
+	// Iterative with an explicit parent stack, so deep or malformed hierarchies cannot overflow the call stack.
+	bool parseHierarchy( std::istream& is ) {
+		bones.clear();
+		std::vector<int> parent;
 		std::string tmp;
-		is >> tmp; // HIERARCHY
 		int dataIndex = 0;
-		while( bones.size()==0 || !parent.empty() ) {
-
-			is >> tmp; // JOINT, End, or }
-
-			if(tmp.compare("JOINT")==0 ||  tmp.compare("ROOT")==0 )	{
-
+		if( !expect(is, "HIERARCHY") ) return false;
+		while( is >> tmp ) { // ROOT, JOINT, End, or }
+			if( tmp.compare("JOINT")==0 || tmp.compare("ROOT")==0 ) {
+				if( parent.empty() != (tmp.compare("ROOT")==0) ) return fail("misplaced " + tmp);
 				bones.push_back(Bone());
 				Bone& bone = bones.back();
-				bone.parent = parent.empty()?-1:parent.top();
+				bone.parent = parent.empty()?-1:parent.back();
 				bone.dataOffset = dataIndex;
-				int nChannels;
-				is >> bone.name; std::cout<<bone.name<<std::endl;
-				is >> tmp; // {
-				is >> tmp; // OFFSET
+				int nChannels = -1;
+				is >> bone.name; if(verbose) std::cout<<bone.name<<std::endl;
+				if( !expect(is, "{") || !expect(is, "OFFSET") ) return false;
 				is >> bone.offset.x >> bone.offset.y >> bone.offset.z;
 				bone.offset *= OFFSET_SCALE;
-				is >> tmp; // CHANNELS
+				if( !expect(is, "CHANNELS") ) return false;
 				is >> nChannels;
+				if( nChannels < 0 || nChannels > 6 ) return fail(bone.name + ": bad channel count");
 				for(int i=0; i<nChannels; i++) {
 					is >> tmp;
 					if(tmp.compare("Xposition") == 0)      bone.channelTypes.push_back(Bone::CHANNEL_TYPE::X_POSITION);
@@ -177,27 +240,60 @@ struct Body {
 					else if(tmp.compare("Xrotation") == 0) bone.channelTypes.push_back(Bone::CHANNEL_TYPE::X_ROTATION);
 					else if(tmp.compare("Yrotation") == 0) bone.channelTypes.push_back(Bone::CHANNEL_TYPE::Y_ROTATION);
 					else if(tmp.compare("Zrotation") == 0) bone.channelTypes.push_back(Bone::CHANNEL_TYPE::Z_ROTATION);
+					else return fail(bone.name + ": unknown channel '" + tmp + "'");
 				}
 				dataIndex+=nChannels;
-				parent.push( bones.size()-1 );
+				parent.push_back( bones.size()-1 );
+			}
+			else if(tmp.compare("End")==0) {
+				if( parent.empty() || !expect(is, "Site") ) return fail("misplaced End Site");
+				bones.push_back(Bone());
+				Bone& bone = bones.back();
+				bone.parent = parent.back();
+				is >> bone.name;
+				if( bone.name.compare("{") == 0 ) // unnamed End Site
+					bone.name = bones[bone.parent].name + "_End";
+				else if( !expect(is, "{") ) return false;
+				if(verbose) std::cout<<bone.name<<std::endl;
+				if( !expect(is, "OFFSET") ) return false;
+				is >> bone.offset.x >> bone.offset.y >> bone.offset.z;
+				bone.offset *= OFFSET_SCALE;
+				if( !expect(is, "}") ) return false;
+			}
+			else if(tmp.compare("}") ==0 ) {
+				if( parent.empty() ) return fail("unbalanced }");
+				parent.pop_back();
+				if( parent.empty() ) break;
 			}
-			else if(tmp.compare("End")==0) readEndSite(is,parent.top());
-			else if(tmp.compare("}") ==0 )
-				parent.pop();
+			else return fail("unexpected '" + tmp + "' in HIERARCHY");
 		}
-		is >> tmp; //MOTION
-		is >> tmp; //Frames
+		if( bones.empty() || !parent.empty() ) return fail("unexpected end of HIERARCHY");
+		if( !expect(is, "MOTION") || !expect(is, "Frames:") ) return false;
 		is >> Nframe; //Nframe value
-		is >> tmp >> tmp;//Frame Time:
+		if( !expect(is, "Frame") || !expect(is, "Time:") ) return false;
 		is >> framerate; //Frame Time value
-		ValuesPerFrame.resize(Nframe, std::vector<float>(dataIndex));
-		std::cout << Nframe << " :"<<framerate << " :" << dataIndex << std::endl;
-		for (int i = 0; i < ValuesPerFrame.size(); i++) {
-			for (int j = 0; j < ValuesPerFrame[i].size(); j++) {
-				is >> ValuesPerFrame[i][j];
+		if( !is || Nframe < 0 ) return fail("bad MOTION header");
+		Nchannel = dataIndex;
+		return true;
+	}
+public:
+	// Optional Link tree over the flat skeleton, stored in `links` (one allocation); the root is links[0].
+	void buildLinks( std::vector<Link>& links ) const {
+		links.clear();
+		links.resize(bones.size());
+		for( int i = 0; i < bones.size(); i++ ) {
+			const Bone& b = bones[i];
+			Link& l = links[i];
+			l.ownsChildren = false;
+			l.name = b.name;
+			l.offset = b.offset;
+			l.tr = b.tr;
+			for( auto c : b.channelTypes ) l.channelTypes.push_back(Link::CHANNEL_TYPE(int(c)));
+			if( b.parent >= 0 ) {
+				l.parent = &links[b.parent];
+				links[b.parent].addChild(&l);
 			}
-		} // read value
-		is.close();
+		}
 	}
 	void update() {//kinematic function
 		for( auto& b: bones ) {
@@ -211,6 +307,7 @@ struct Body {
 			}
 		}
 	}
+#ifndef BVH_HEADLESS
 	void draw() {
 		update();
 		for( auto& b: bones ) {
@@ -218,6 +315,7 @@ struct Body {
 				drawCylinder(b.gp,bones[b.parent].gp,1,glm::vec4(1,0,0,1));
 		}
 	}
+#endif
 	int getNFrames() const {
 		return Nframe;
 	}
@@ -226,30 +324,11 @@ struct Body {
 	}
 
 	void updateBone(int framecount){
-		for (auto& b : bones) {
-			glm::quat q1 = {1,0,0,0};
-			for (int i = 0; i < b.channelTypes.size(); i++) {
-				if (b.channelTypes[i] == Bone::CHANNEL_TYPE::X_POSITION) {
-					b.tr.x = ValuesPerFrame[framecount][b.dataOffset + i]*OFFSET_SCALE;
-				}
-				else if (b.channelTypes[i] == Bone::CHANNEL_TYPE::Y_POSITION) {
-					b.tr.y = ValuesPerFrame[framecount][b.dataOffset + i] * OFFSET_SCALE;
-				}
-				else if (b.channelTypes[i] == Bone::CHANNEL_TYPE::Z_POSITION) {
-					b.tr.z = ValuesPerFrame[framecount][b.dataOffset + i] * OFFSET_SCALE;
-				}
-				else if (b.channelTypes[i] == Bone::CHANNEL_TYPE::X_ROTATION) {
-					q1*=glm::exp(glm::quat(0, glm::vec3(ValuesPerFrame[framecount][b.dataOffset + i],0,0)*RADIAN / 2.f));
-				}
-				else if (b.channelTypes[i] == Bone::CHANNEL_TYPE::Y_ROTATION) {
-					q1*=glm::exp(glm::quat(0, glm::vec3(0,ValuesPerFrame[framecount][b.dataOffset + i],0)*RADIAN / 2.f));
-				}
-				else if (b.channelTypes[i] == Bone::CHANNEL_TYPE::Z_ROTATION) {
-					q1*=glm::exp(glm::quat(0, glm::vec3(0, 0, ValuesPerFrame[framecount][b.dataOffset + i]) *RADIAN/ 2.f));
-				}
-			}
-			b.ro = q1;
-		}
+		updateBone(ValuesPerFrame[framecount].data());
+	}
+	void updateBone(const float* values){// one frame of channel values, laid out as in the MOTION rows
+		for (auto& b : bones)
+			b.pose(values, b.tr, b.ro);
 	}
 };
 
@@ -0,0 +1,183 @@
+#ifndef __COLLIDERS_HPP__
+#define __COLLIDERS_HPP__
+
+#include "bvh.hpp"
+#include <algorithm>
+
+// Capsule proxies of an animated Body for cloth and particle collision.
+// One capsule per parent-child bone pair, between the two joints' gp. update() is called
+// once per animation frame after Body::update(); the capsules then move linearly from the
+// previous frame's pose to the new one, and setSubstep(s) places them at fraction s of
+// that motion so a simulation with many substeps per frame sees a continuous sweep instead
+// of a jump. The broad phase is a uniform grid over the swept bounds of the whole frame,
+// rebuilt in update(), so it is valid for every substep.
+
+struct Capsule {
+	int a, b;				// bones: a is the parent of b
+	float radius;
+	glm::vec3 p0, p1;		// endpoints at the current substep
+	glm::vec3 v0, v1;		// endpoint velocities over the frame
+	glm::vec3 lo, hi;		// bounds swept over the frame, radius included
+};
+
+struct CapsuleColliders {
+	std::vector<Capsule> capsules;
+	float restitution = 0.2f;
+	float friction = 0.5f;
+	int maxCells = 32;		// grid cells along the longest axis of the swept bounds
+	float scale = 1.f;		// body to simulation space: gp * scale + offset
+	glm::vec3 offset = glm::vec3(0);
+
+	glm::vec3 place(const glm::vec3& p) const { return p * scale + offset; }
+
+	// radius: capsule radius in simulation space, the same for every bone.
+	void build(const Body& body, float radius) {
+		capsules.clear();
+		for( int i = 0; i < body.bones.size(); i++ ) {
+			int p = body.bones[i].parent;
+			if( p < 0 ) continue;
+			Capsule c;
+			c.a = p;
+			c.b = i;
+			c.radius = radius;
+			c.p0 = place(body.bones[p].gp);
+			c.p1 = place(body.bones[i].gp);
+			c.v0 = c.v1 = glm::vec3(0);
+			capsules.push_back(c);
+		}
+		start0.resize(capsules.size());
+		start1.resize(capsules.size());
+		end0.resize(capsules.size());
+		end1.resize(capsules.size());
+		first = true;
+	}
+
+	// New frame: body must be posed and updated, dt is the time since the previous update().
+	void update(const Body& body, float dt) {
+		for( int i = 0; i < capsules.size(); i++ ) {
+			Capsule& c = capsules[i];
+			glm::vec3 e0 = place(body.bones[c.a].gp), e1 = place(body.bones[c.b].gp);
+			start0[i] = first ? e0 : end0[i];
+			start1[i] = first ? e1 : end1[i];
+			end0[i] = e0;
+			end1[i] = e1;
+			c.v0 = dt > 0 ? (e0 - start0[i]) / dt : glm::vec3(0);
+			c.v1 = dt > 0 ? (e1 - start1[i]) / dt : glm::vec3(0);
+			c.lo = glm::min(glm::min(start0[i], start1[i]), glm::min(e0, e1)) - glm::vec3(c.radius);
+			c.hi = glm::max(glm::max(start0[i], start1[i]), glm::max(e0, e1)) + glm::vec3(c.radius);
+			c.p0 = start0[i];
+			c.p1 = start1[i];
+		}
+		first = false;
+		this->dt = dt;
+		buildGrid();
+	}
+
+	// Forgets the previous pose, so the next update() jumps there without sweeping,
+	// e.g. when playback loops back to the first frame.
+	void reset() { first = true; }
+
+	// Places the capsules at fraction s in [0,1] of the motion since the previous frame.
+	void setSubstep(float s) {
+		for( int i = 0; i < capsules.size(); i++ ) {
+			Capsule& c = capsules[i];
+			c.p0 = start0[i] + c.v0 * (s * dt);
+			c.p1 = start1[i] + c.v1 * (s * dt);
+		}
+	}
+
+	// Pushes a particle at x (at `from` before this substep) out of the capsules and
+	// reflects its velocity relative to the capsule surface. Returns true on contact.
+	bool resolve(glm::vec3& x, glm::vec3& v, const glm::vec3& from) const {
+		int cell = cellOf(x);
+		if( cell < 0 ) return false;
+		bool hit = false;
+		for( int k = cellStart[cell]; k < cellStart[cell+1]; k++ ) {
+			const Capsule& c = capsules[cellItems[k]];
+			if( x.x < c.lo.x || x.y < c.lo.y || x.z < c.lo.z || x.x > c.hi.x || x.y > c.hi.y || x.z > c.hi.z ) continue;
+			float u;
+			glm::vec3 q = closest(c, x, u);
+			glm::vec3 d = x - q;
+			float dist = glm::length(d);
+			if( dist >= c.radius ) continue;
+			// the side the particle came from, so a fast crossing is not pushed out through the far side
+			float uf;
+			glm::vec3 df = from - closest(c, from, uf);
+			glm::vec3 N;
+			if( glm::dot(df, d) < 0 || dist < 1e-6f ) N = glm::length(df) > 1e-6f ? glm::normalize(df) : glm::vec3(0,1,0);
+			else N = d / dist;
+			x = q + N * c.radius;
+			glm::vec3 vc = glm::mix(c.v0, c.v1, u);
+			glm::vec3 vr = v - vc;
+			float vn = glm::dot(vr, N);
+			if( vn < 0 ) {
+				glm::vec3 vt = vr - vn * N;
+				float lt = glm::length(vt);
+				if( lt > 1e-6f ) vt *= std::max(0.f, 1 - friction * -vn / lt);
+				vr = vt - restitution * vn * N;
+			}
+			v = vc + vr;
+			hit = true;
+		}
+		return hit;
+	}
+
+private:
+	std::vector<glm::vec3> start0, start1;	// endpoints at the previous frame
+	std::vector<glm::vec3> end0, end1;		// and at the current one
+	float dt = 0;
+	bool first = true;
+	glm::vec3 gridLo = glm::vec3(0);
+	float cellSize = 1;
+	glm::ivec3 dims = glm::ivec3(0);
+	std::vector<int> cellStart, cellItems;	// capsules per cell, compressed rows
+
+	static glm::vec3 closest(const Capsule& c, const glm::vec3& x, float& u) {
+		glm::vec3 e = c.p1 - c.p0;
+		float l2 = glm::dot(e, e);
+		u = l2 > 1e-12f ? std::min(1.f, std::max(0.f, glm::dot(x - c.p0, e) / l2)) : 0.f;
+		return c.p0 + e * u;
+	}
+	int cellOf(const glm::vec3& x) const {
+		if( cellItems.empty() ) return -1;
+		glm::vec3 f = (x - gridLo) / cellSize;
+		if( f.x < 0 || f.y < 0 || f.z < 0 ) return -1;
+		glm::ivec3 c = glm::ivec3(f);
+		if( c.x >= dims.x || c.y >= dims.y || c.z >= dims.z ) return -1;
+		return (c.z * dims.y + c.y) * dims.x + c.x;
+	}
+	void buildGrid() {
+		cellItems.clear();
+		if( capsules.empty() ) return;
+		glm::vec3 lo = capsules[0].lo, hi = capsules[0].hi;
+		for( auto& c : capsules ) {
+			lo = glm::min(lo, c.lo);
+			hi = glm::max(hi, c.hi);
+		}
+		glm::vec3 ext = hi - lo;
+		cellSize = std::max(1e-3f, std::max(ext.x, std::max(ext.y, ext.z)) / maxCells);
+		gridLo = lo;
+		dims = glm::max(glm::ivec3(1), glm::ivec3(ext / cellSize) + 1);
+		int nc = dims.x * dims.y * dims.z;
+		cellStart.assign(nc + 1, 0);
+		forEachCell([&](int, int cell) { cellStart[cell+1]++; });
+		for( int i = 0; i < nc; i++ ) cellStart[i+1] += cellStart[i];
+		cellItems.resize(cellStart[nc]);
+		std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+		forEachCell([&](int k, int cell) { cellItems[fill[cell]++] = k; });
+	}
+	template<typename F> void forEachCell(F f) const {
+		for( int k = 0; k < capsules.size(); k++ ) {
+			glm::ivec3 a = cellRange(capsules[k].lo), b = cellRange(capsules[k].hi);
+			for( int z = a.z; z <= b.z; z++ )
+				for( int y = a.y; y <= b.y; y++ )
+					for( int x = a.x; x <= b.x; x++ ) f(k, (z * dims.y + y) * dims.x + x);
+		}
+	}
+	glm::ivec3 cellRange(const glm::vec3& x) const {
+		glm::ivec3 c = glm::ivec3((x - gridLo) / cellSize);
+		return glm::max(glm::ivec3(0), glm::min(dims - 1, c));
+	}
+};
+
+#endif
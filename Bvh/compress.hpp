@@ -0,0 +1,279 @@
+#ifndef __COMPRESS_HPP__
+#define __COMPRESS_HPP__
+
+#include "bvh.hpp"
+#include <cstdint>
+#include <algorithm>
+
+// Error-bounded keyframe compression of Body::ValuesPerFrame.
+// Every channel keeps a sparse set of keys (16-bit frame gap + 16-bit quantized value,
+// or a float value for channels whose quantization step alone exceeds the budget)
+// and is rebuilt with a non-uniform Catmull-Rom curve written in the same Bezier form
+// as the CATMULL case of CurveInterpolation.cpp.
+// The error budget is a world-space position error measured on the FK output of Body::update.
+
+inline float bezier(float p0, float p1, float p2, float p3, float t) {
+	float t1 = 1 - t;
+	return t1 * t1 * t1 * p0 + 3 * t1 * t1 * t * p1 + 3 * t1 * t * t * p2 + t * t * t * p3;
+}
+
+// kf/kv: key frames and values, nk keys. seg: key index with kf[seg] <= frame
+inline float evaluateKeys(const int* kf, const float* kv, int nk, int seg, float frame) {
+	if( seg >= nk-1 ) return kv[nk-1];
+	float h = float(kf[seg+1] - kf[seg]);
+	float v0 = seg > 0 ? (kv[seg+1]-kv[seg-1])/(kf[seg+1]-kf[seg-1]) : (kv[1]-kv[0])/h;
+	float v1 = seg+1 < nk-1 ? (kv[seg+2]-kv[seg])/(kf[seg+2]-kf[seg]) : (kv[seg+1]-kv[seg])/h;
+	float p0 = kv[seg];
+	float p3 = kv[seg+1];
+	float p1 = p0 + v0 * h / 3.f;
+	float p2 = p3 - v1 * h / 3.f;
+	return bezier(p0, p1, p2, p3, (frame - kf[seg]) / h);
+}
+
+const int MAX_KEY_GAP = 65535;
+
+struct CompressedChannel {
+	float minV = 0.f;
+	float range = 0.f;
+	std::vector<uint16_t> gaps;   // frame distance from the previous key, gaps[0] = 0
+	std::vector<uint16_t> values; // quantized key values
+	std::vector<float> exact;     // lossless key values instead, if not empty
+
+	uint16_t quantize(float v) const {
+		if( range <= 0 ) return 0;
+		return (uint16_t)std::round(glm::clamp((v - minV) / range, 0.f, 1.f) * 65535.f);
+	}
+	float dequantize(uint16_t q) const {
+		return minV + range * q / 65535.f;
+	}
+	float key(int i) const {
+		return exact.empty() ? dequantize(values[i]) : exact[i];
+	}
+};
+
+struct CompressedMotion {
+	int Nframe = 0;
+	int Nchannel = 0;
+	float framerate = 0.f;
+	std::vector<CompressedChannel> channels;
+
+	size_t bytes() const {
+		size_t ret = sizeof(CompressedMotion);
+		for( auto& c : channels )
+			ret += sizeof(CompressedChannel) + (c.gaps.size() + c.values.size()) * sizeof(uint16_t) + c.exact.size() * sizeof(float);
+		return ret;
+	}
+	size_t rawBytes() const {
+		return size_t(Nframe) * Nchannel * sizeof(float);
+	}
+
+	// Greedy key insertion: every pass adds the worst frame of each segment that is off by more than tol.
+	static void fitChannel(const std::vector<float>& v, float tol, std::vector<int>& keys) {
+		std::vector<float> kv;
+		std::vector<int> inserts;
+		while( true ) {
+			for( int i = 1; i < keys.size(); i++ ) // gaps must fit in 16 bits
+				if( keys[i] - keys[i-1] > MAX_KEY_GAP )
+					inserts.push_back( keys[i-1] + MAX_KEY_GAP );
+			kv.resize(keys.size());
+			for( int i = 0; i < keys.size(); i++ ) kv[i] = v[keys[i]];
+			for( int s = 0; s < int(keys.size()) - 1; s++ ) {
+				int worst = -1;
+				float worstErr = tol;
+				for( int f = keys[s] + 1; f < keys[s+1]; f++ ) {
+					float e = std::abs( evaluateKeys(keys.data(), kv.data(), keys.size(), s, f) - v[f] );
+					if( e > worstErr ) {
+						worstErr = e;
+						worst = f;
+					}
+				}
+				if( worst >= 0 ) inserts.push_back(worst);
+			}
+			if( inserts.empty() ) break;
+			keys.insert(keys.end(), inserts.begin(), inserts.end());
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+			inserts.clear();
+		}
+	}
+
+	// Returns false if the budget could not be met; the result is then the closest attempt.
+	bool compress(const Body& body, float errorBudget);
+	// Rebuilds Body::ValuesPerFrame for tools that still want the dense table.
+	void decompress(Body& body) const;
+};
+
+// Playback decoder. Keeps a key cursor per channel, so forward playback costs O(1) per channel and frame;
+// seeking backwards restarts the cursors from the first key.
+struct MotionDecoder {
+	struct Cursor {
+		int key = 0;
+		int frame = 0; // absolute frame of key
+	};
+	const CompressedMotion& motion;
+	std::vector<Cursor> cursors;
+
+	MotionDecoder(const CompressedMotion& m) : motion(m), cursors(m.Nchannel) {}
+
+	void decode(int frame, float* out) {
+		for( int c = 0; c < motion.Nchannel; c++ ) {
+			const CompressedChannel& ch = motion.channels[c];
+			Cursor& cur = cursors[c];
+			int n = ch.gaps.size();
+			if( frame < cur.frame ) cur = Cursor();
+			while( cur.key+1 < n && cur.frame + ch.gaps[cur.key+1] <= frame ) {
+				cur.key++;
+				cur.frame += ch.gaps[cur.key];
+			}
+			int k = cur.key;
+			if( k >= n-1 ) {
+				out[c] = ch.key(n-1);
+				continue;
+			}
+			// four keys around the segment, as evaluateKeys() would see them
+			int kf[4];
+			float kv[4];
+			int first = k > 0 ? k-1 : k;
+			int last = std::min(k+2, n-1);
+			kf[k-first] = cur.frame;
+			for( int i = k-1; i >= first; i-- ) kf[i-first] = kf[i+1-first] - ch.gaps[i+1];
+			for( int i = k+1; i <= last; i++ ) kf[i-first] = kf[i-1-first] + ch.gaps[i];
+			for( int i = first; i <= last; i++ ) kv[i-first] = ch.key(i);
+			out[c] = evaluateKeys(kf, kv, last-first+1, k-first, float(frame));
+		}
+	}
+};
+
+inline bool CompressedMotion::compress(const Body& body, float errorBudget) {
+	Nframe = body.Nframe;
+	Nchannel = body.Nchannel;
+	framerate = body.framerate;
+	channels.assign(Nchannel, CompressedChannel());
+	if( Nframe == 0 ) return true;
+	const int nb = body.bones.size();
+
+	Body fk;
+	fk.bones = body.bones;
+	std::vector<glm::vec3> ref(size_t(Nframe) * nb);
+	for( int f = 0; f < Nframe; f++ ) {
+		fk.updateBone(body.ValuesPerFrame[f].data());
+		fk.update();
+		for( int b = 0; b < nb; b++ ) ref[size_t(f)*nb + b] = fk.bones[b].gp;
+	}
+
+	// Per channel tolerance from how far a change in that channel can move the joints below it.
+	std::vector<float> reach(nb, 0.f);
+	for( int b = nb-1; b > 0; b-- ) {
+		int p = body.bones[b].parent;
+		if( p >= 0 ) reach[p] = std::max(reach[p], reach[b] + glm::length(body.bones[b].offset));
+	}
+	std::vector<float> tol(Nchannel, 0.f);
+	for( int b = 0; b < nb; b++ ) {
+		const Bone& bone = body.bones[b];
+		for( int i = 0; i < bone.channelTypes.size(); i++ ) {
+			bool isPosition = bone.channelTypes[i] == Bone::CHANNEL_TYPE::X_POSITION
+						   || bone.channelTypes[i] == Bone::CHANNEL_TYPE::Y_POSITION
+						   || bone.channelTypes[i] == Bone::CHANNEL_TYPE::Z_POSITION;
+			if( isPosition ) tol[bone.dataOffset + i] = 0.25f * errorBudget / OFFSET_SCALE;
+			else             tol[bone.dataOffset + i] = 0.25f * errorBudget / (std::max(reach[b], 1e-3f) * RADIAN);
+		}
+	}
+
+	// Quantize first so that the fit sees exactly what the decoder will produce.
+	std::vector<std::vector<float>> column(Nchannel, std::vector<float>(Nframe));
+	for( int c = 0; c < Nchannel; c++ ) {
+		float lo = body.ValuesPerFrame[0][c], hi = lo;
+		for( int f = 0; f < Nframe; f++ ) {
+			lo = std::min(lo, body.ValuesPerFrame[f][c]);
+			hi = std::max(hi, body.ValuesPerFrame[f][c]);
+		}
+		channels[c].minV = lo;
+		channels[c].range = hi - lo;
+		for( int f = 0; f < Nframe; f++ )
+			column[c][f] = channels[c].dequantize(channels[c].quantize(body.ValuesPerFrame[f][c]));
+	}
+
+	// Pinning frames cannot remove the quantization error itself. When it stops helping,
+	// the channels whose quantization step is coarse for their tolerance switch to float
+	// keys, then all of them; if even that fails the budget is out of reach.
+	const int MAX_ITERATIONS = 32;
+	std::vector<bool> lossless(Nchannel, false);
+	auto makeLossless = [&](int c) {
+		lossless[c] = true;
+		for( int f = 0; f < Nframe; f++ ) column[c][f] = body.ValuesPerFrame[f][c];
+	};
+	std::vector<int> forced = { 0, Nframe-1 };
+	std::vector<std::vector<int>> keys(Nchannel);
+	std::vector<float> row(Nchannel);
+	int stage = 0;	// 0: pinning, 1: coarse channels lossless, 2: all channels lossless
+	for( int iter = 0; iter < MAX_ITERATIONS; iter++ ) {
+		for( int c = 0; c < Nchannel; c++ ) {
+			keys[c] = forced;
+			keys[c].erase(std::unique(keys[c].begin(), keys[c].end()), keys[c].end());
+			fitChannel(column[c], tol[c], keys[c]);
+		}
+		for( int c = 0; c < Nchannel; c++ ) {
+			CompressedChannel& ch = channels[c];
+			ch.gaps.resize(keys[c].size());
+			ch.values.assign(lossless[c] ? 0 : keys[c].size(), 0);
+			ch.exact.assign(lossless[c] ? keys[c].size() : 0, 0.f);
+			for( int i = 0; i < keys[c].size(); i++ ) {
+				ch.gaps[i] = i > 0 ? uint16_t(keys[c][i] - keys[c][i-1]) : 0;	// <= MAX_KEY_GAP, see fitChannel
+				float v = body.ValuesPerFrame[keys[c][i]][c];
+				if( lossless[c] ) ch.exact[i] = v;
+				else ch.values[i] = ch.quantize(v);
+			}
+		}
+
+		// Verify on FK; tighten tolerances a few times, then pin the offending frames.
+		std::vector<int> bad;
+		MotionDecoder decoder(*this);
+		for( int f = 0; f < Nframe; f++ ) {
+			decoder.decode(f, row.data());
+			fk.updateBone(row.data());
+			fk.update();
+			for( int b = 0; b < nb; b++ ) {
+				if( glm::length(fk.bones[b].gp - ref[size_t(f)*nb + b]) > errorBudget ) {
+					bad.push_back(f);
+					break;
+				}
+			}
+		}
+		if( bad.empty() ) return true;
+		if( iter < 3 ) {
+			for( auto& t : tol ) t *= 0.5f;
+			continue;
+		}
+		size_t pinned = forced.size();
+		forced.insert(forced.end(), bad.begin(), bad.end());
+		std::sort(forced.begin(), forced.end());
+		forced.erase(std::unique(forced.begin(), forced.end()), forced.end());
+		if( forced.size() > pinned ) continue;
+		// every bad frame is a key already: only the value precision is left
+		if( stage == 2 ) break;
+		if( stage == 0 ) {
+			stage = 1;
+			for( int c = 0; c < Nchannel; c++ )
+				if( channels[c].range / 65535.f > tol[c] ) makeLossless(c);
+		}
+		else stage = 2;
+		if( stage == 2 || std::find(lossless.begin(), lossless.end(), true) == lossless.end() ) {
+			stage = 2;
+			for( int c = 0; c < Nchannel; c++ ) makeLossless(c);
+		}
+	}
+	std::cerr << "compress: error budget " << errorBudget << " not met" << std::endl;
+	return false;
+}
+
+inline void CompressedMotion::decompress(Body& body) const {
+	MotionDecoder decoder(*this);
+	body.Nframe = Nframe;
+	body.Nchannel = Nchannel;
+	body.framerate = framerate;
+	body.ValuesPerFrame.resize(Nframe, std::vector<float>(Nchannel));
+	for( int f = 0; f < Nframe; f++ )
+		decoder.decode(f, body.ValuesPerFrame[f].data());
+}
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef __IK_HPP__
+#define __IK_HPP__
+
+#include "bvh.hpp"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+// Inverse kinematics on top of Body playback.
+// A chain is a run of bones from `base` down to the end effector `tip`; the solvers rotate
+// base..tip-1 and write local rotations back into Bone::ro. Body::update() must have run
+// for the current pose. The chain owns its workspace, so solving does not allocate, and
+// only the subtree under `base` is re-evaluated afterwards.
+
+struct IKChain {
+	enum class METHOD {
+		CCD,
+		FABRIK,
+		DLS,	// damped least squares on the positional Jacobian
+	};
+
+	std::vector<int> bones;		// base..tip, each bone the parent of the next
+	int subtreeEnd = 0;			// bones[base, subtreeEnd) are base and its descendants
+	float damping = 1.f;		// DLS lambda, in the same units as bone offsets
+	int maxIterations = 16;
+	float tolerance = 0.1f;
+
+	// chain from `tip` up `length` joints (length+1 bones). Relies on parents preceding children.
+	IKChain(const Body& body, int tip, int length) {
+		for( int b = tip; b >= 0 && bones.size() <= length; b = body.bones[b].parent )
+			bones.push_back(b);
+		std::reverse(bones.begin(), bones.end());
+		int base = bones[0];
+		subtreeEnd = base + 1;
+		while( subtreeEnd < body.bones.size() && isDescendant(body, subtreeEnd, base) ) subtreeEnd++;
+		int n = bones.size();
+		pos.resize(n);
+		lengths.resize(n);
+		J.resize(3 * 3 * n);
+		dtheta.resize(3 * n);
+	}
+
+	// Returns the remaining distance between the tip and the target.
+	float solve(Body& body, const glm::vec3& target, METHOD method = METHOD::FABRIK) {
+		if( bones.size() < 2 ) return glm::length(body.bones[bones[0]].gp - target);
+		switch( method ) {
+			case METHOD::CCD:		solveCCD(body, target); break;
+			case METHOD::DLS:		solveDLS(body, target); break;
+			case METHOD::FABRIK:
+			default:				solveFABRIK(body, target); break;
+		}
+		updateFK(body);
+		return glm::length(body.bones[bones.back()].gp - target);
+	}
+
+	// FK for base and its descendants only.
+	void updateFK(Body& body) const {
+		for( int i = bones[0]; i < subtreeEnd; i++ ) updateBoneFK(body, i);
+	}
+
+private:
+	std::vector<glm::vec3> pos;
+	std::vector<float> lengths;
+	std::vector<float> J;		// 3 x 3n, column major
+	std::vector<float> dtheta;
+
+	static bool isDescendant(const Body& body, int b, int base) {
+		for( int p = body.bones[b].parent; p >= 0; p = body.bones[p].parent )
+			if( p == base ) return true;
+		return false;
+	}
+	static void updateBoneFK(Body& body, int i) {
+		Bone& b = body.bones[i];
+		if( b.parent >= 0 ) {
+			const Bone& p = body.bones[b.parent];
+			b.gq = p.gq * b.ro;
+			b.gp = rotate(p.gq, b.offset) + b.tr + p.gp;
+		}
+		else {
+			b.gq = b.ro;
+			b.gp = rotate(b.gq, b.offset) + b.tr;
+		}
+	}
+	// FK along the chain only, from chain index i down to the tip
+	void updateChainFK(Body& body, int i) const {
+		for( int k = i; k < bones.size(); k++ ) updateBoneFK(body, bones[k]);
+	}
+	// Applies a world-space rotation to chain joint i and stores it as a local rotation.
+	static void rotateGlobal(Body& body, int bone, const glm::quat& r) {
+		Bone& b = body.bones[bone];
+		glm::quat gq = glm::normalize(r * b.gq);
+		glm::quat pq = b.parent >= 0 ? body.bones[b.parent].gq : glm::quat(1,0,0,0);
+		b.ro = glm::normalize(inverse(pq) * gq);
+		b.gq = gq;
+	}
+
+	void solveCCD(Body& body, const glm::vec3& target) {
+		int n = bones.size();
+		for( int it = 0; it < maxIterations; it++ ) {
+			for( int i = n-2; i >= 0; i-- ) {
+				glm::vec3 pj = body.bones[bones[i]].gp;
+				glm::vec3 tip = body.bones[bones[n-1]].gp;
+				rotateGlobal(body, bones[i], rotationBetween(tip - pj, target - pj));
+				updateChainFK(body, i+1);
+			}
+			if( glm::length(body.bones[bones[n-1]].gp - target) < tolerance ) break;
+		}
+	}
+
+	void solveFABRIK(Body& body, const glm::vec3& target) {
+		int n = bones.size();
+		float total = 0;
+		for( int i = 0; i < n; i++ ) pos[i] = body.bones[bones[i]].gp;
+		for( int i = 0; i < n-1; i++ ) {
+			lengths[i] = glm::length(pos[i+1] - pos[i]);
+			total += lengths[i];
+		}
+		glm::vec3 base = pos[0];
+		if( glm::length(target - base) >= total ) { // out of reach: stretch toward the target
+			glm::vec3 d = glm::normalize(target - base);
+			for( int i = 1; i < n; i++ ) pos[i] = pos[i-1] + d * lengths[i-1];
+		}
+		else {
+			for( int it = 0; it < maxIterations; it++ ) {
+				pos[n-1] = target;
+				for( int i = n-2; i >= 0; i-- )
+					pos[i] = pos[i+1] + safeDir(pos[i] - pos[i+1]) * lengths[i];
+				pos[0] = base;
+				for( int i = 1; i < n; i++ )
+					pos[i] = pos[i-1] + safeDir(pos[i] - pos[i-1]) * lengths[i-1];
+				if( glm::length(pos[n-1] - target) < tolerance ) break;
+			}
+		}
+		// back to rotations, one joint at a time from the base
+		for( int i = 0; i < n-1; i++ ) {
+			glm::vec3 pj = body.bones[bones[i]].gp;
+			glm::vec3 child = body.bones[bones[i+1]].gp;
+			rotateGlobal(body, bones[i], rotationBetween(child - pj, pos[i+1] - pj));
+			updateChainFK(body, i+1);
+		}
+	}
+	static glm::vec3 safeDir(const glm::vec3& v) {
+		float l = glm::length(v);
+		return l > 1e-6f ? v / l : glm::vec3(0,1,0);
+	}
+
+	void solveDLS(Body& body, const glm::vec3& target) {
+		int n = bones.size();
+		int cols = 3 * (n-1);
+		for( int it = 0; it < maxIterations; it++ ) {
+			glm::vec3 tip = body.bones[bones[n-1]].gp;
+			glm::vec3 e = target - tip;
+			if( glm::length(e) < tolerance ) break;
+			// columns: world axis x (tip - joint) for each joint and axis
+			for( int i = 0; i < n-1; i++ ) {
+				glm::vec3 r = tip - body.bones[bones[i]].gp;
+				for( int a = 0; a < 3; a++ ) {
+					glm::vec3 axis(0);
+					axis[a] = 1;
+					glm::vec3 c = glm::cross(axis, r);
+					float* col = &J[3 * (3*i + a)];
+					col[0] = c.x; col[1] = c.y; col[2] = c.z;
+				}
+			}
+			// dtheta = J^T (J J^T + lambda^2 I)^-1 e
+			glm::mat3 JJt(damping * damping);
+			for( int c = 0; c < cols; c++ ) {
+				const float* col = &J[3*c];
+				for( int r = 0; r < 3; r++ )
+					for( int s = 0; s < 3; s++ )
+						JJt[s][r] += col[r] * col[s];
+			}
+			glm::vec3 y = glm::inverse(JJt) * e;
+			for( int c = 0; c < cols; c++ )
+				dtheta[c] = J[3*c] * y.x + J[3*c+1] * y.y + J[3*c+2] * y.z;
+			for( int i = 0; i < n-1; i++ ) {
+				glm::vec3 w(dtheta[3*i], dtheta[3*i+1], dtheta[3*i+2]);
+				rotateGlobal(body, bones[i], glm::exp(glm::quat(0, w / 2.f)));
+				updateChainFK(body, i+1);
+			}
+		}
+	}
+};
+
+struct IKTask {
+	Body* body = nullptr;
+	IKChain* chain = nullptr;	// chains belong to one body each
+	glm::vec3 target = glm::vec3(0);
+	IKChain::METHOD method = IKChain::METHOD::FABRIK;
+	float error = 0.f;			// output: remaining distance
+};
+
+// Solves many characters' chains in parallel. Tasks on the same body must not share a subtree.
+inline void solveIK(std::vector<IKTask>& tasks, int threads = 0) {
+	if( threads <= 0 ) threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1, std::min<int>(threads, tasks.size() / 8));
+	std::atomic<int> next(0);
+	auto work = [&]() {
+		for( int i = next++; i < tasks.size(); i = next++ )
+			tasks[i].error = tasks[i].chain->solve(*tasks[i].body, tasks[i].target, tasks[i].method);
+	};
+	std::vector<std::thread> pool;
+	for( int t = 1; t < threads; t++ ) pool.emplace_back(work);
+	work();
+	for( auto& t : pool ) t.join();
+}
+
+#endif
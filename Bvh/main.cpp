@@ -11,6 +11,7 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/transform.hpp>
 #include "bvh.hpp"
+#include "../simrunner.hpp"
 
 using namespace glm;
 glm::quat q;
@@ -29,34 +30,58 @@ void drawK( glm::vec3 pos, float sz=1, const glm::vec4& color=glm::vec4(1,0.4,0,
 
 
 Link* body;
+std::vector<Link> links;
 
 void readBVH(const std::string & fn) {
-	std::ifstream ifs(fn);
-	std::string tmp;
-	ifs >> tmp; // HIERARCHY
-	ifs >> tmp; // Root
-	body = Link::readJoint(ifs,nullptr);
+	Body tmp;
+	if( !tmp.readBVH(fn) ) return;
+	tmp.buildLinks(links);
+	body = &links[0];
 	body->print(std::cout,0);
-	ifs.close();
 }
 Body b;
+SimRunner<std::vector<glm::vec3>> runner;	// bone positions of the latest posed frame
 
 
 
 void render() {
 	drawQuad(glm::vec3(0), glm::vec3(0,1,0), glm::vec2(1000,1000), glm::vec4(0,0,1,1));
 //	body->draw(vec3(0), quat(1,vec3(0)));
-	b.draw();
+	const std::vector<glm::vec3>* gp = runner.latest();
+	if( gp ) {
+		for( int i = 0; i < b.bones.size(); i++ )
+			if( b.bones[i].parent >= 0 )
+				drawCylinder((*gp)[i], (*gp)[b.bones[i].parent], 1, glm::vec4(1,0,0,1));
+	}
 
 }
 
-void frame(float t) {
-	frameCount = std::min(b.getNFrames()-1,(int)std::round(animView->progress()/b.getFrameRate()));
+// Runs on the simulation thread; t is the playback time.
+void pose(float t) {
+	frameCount = std::min(b.getNFrames()-1,(int)std::round(t/b.getFrameRate()));
 	b.updateBone(frameCount);
+	b.update();
+}
+
+void frame(float t) {
+	runner.request(animView->progress());
 }
 
 void init() {
+	runner.stop();	// the worker writes frameCount and the bones
 	frameCount = 0;
+	runner.start(pose, [](std::vector<glm::vec3>& gp) {
+		gp.resize(b.bones.size());
+		for( int i = 0; i < b.bones.size(); i++ ) gp[i] = b.bones[i].gp;
+	});
+}
+
+void keyFunc(int key) {
+	if( key == 'p' ) {
+		SimStats s = runner.stats();
+		std::cout << s.steps << " steps, " << s.late << " late, " << s.skipped << " skipped, "
+				  << s.unseen << " never drawn, step " << s.meanStepMs << " ms avg " << s.maxStepMs << " ms max" << std::endl;
+	}
 }
 
 int main(int argc, const char * argv[]) {
@@ -70,6 +95,7 @@ int main(int argc, const char * argv[]) {
 	animView->renderFunction = render;
 	animView->frameFunction = frame;
 	animView->initFunction = init;
+	animView->keyFunction = keyFunc;
 	
 	init();
 	window->show();
@@ -0,0 +1,290 @@
+#ifndef __MATCHING_HPP__
+#define __MATCHING_HPP__
+
+#include "bvh.hpp"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cfloat>
+
+// Motion matching feature database over Body clips.
+// Per frame feature (raw layout, everything in the root's facing frame, y up):
+//   [ bone positions relative to the root    3 x bones ]
+//   [ bone velocities                         3 x bones ]
+//   [ future root position (x,z), facing (x,z)  4 x trajectoryFrames ]
+// Features are normalized per group and stored contiguously in KD-tree leaf order.
+// All clips must share one skeleton.
+
+struct MatchingConfig {
+	std::vector<int> bones;								// e.g. feet and hips
+	std::vector<int> trajectoryFrames = { 20, 40, 60 };	// frames ahead of the current one
+	float positionWeight = 1.f;
+	float velocityWeight = 1.f;
+	float trajectoryWeight = 1.f;
+};
+
+struct MatchResult {
+	int clip = -1;
+	int frame = -1;
+	float dist = FLT_MAX;	// squared distance in normalized feature space
+};
+
+struct MatchingDatabase {
+	static const int LEAF_SIZE = 16;
+
+	MatchingConfig config;
+	int dim = 0;
+	int size = 0;
+	std::vector<float> features;	// size x dim, normalized, in tree order
+	std::vector<int> clipOf, frameOf;
+	std::vector<float> mean, scale;
+
+	void build(const std::vector<const Body*>& clips, const MatchingConfig& cfg, int threads = 0) {
+		config = cfg;
+		dim = 6 * config.bones.size() + 4 * config.trajectoryFrames.size();
+		if( threads <= 0 ) threads = std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<int> first(clips.size() + 1, 0);
+		for( int c = 0; c < clips.size(); c++ ) first[c+1] = first[c] + clips[c]->Nframe;
+		size = first.back();
+		std::vector<float> raw(size_t(size) * dim);
+		std::vector<int> clipRaw(size), frameRaw(size);
+
+		// feature extraction: tasks of up to 1024 frames, each thread with its own skeleton
+		struct Task { int clip, begin, end; };
+		std::vector<Task> tasks;
+		for( int c = 0; c < clips.size(); c++ )
+			for( int f = 0; f < clips[c]->Nframe; f += 1024 )
+				tasks.push_back({ c, f, std::min(f + 1024, clips[c]->Nframe) });
+		std::atomic<int> next(0);
+		parallel(threads, [&]() {
+			Body fk;
+			std::vector<glm::vec3> scratch;
+			for( int i = next++; i < tasks.size(); i = next++ ) {
+				const Task& t = tasks[i];
+				const Body& clip = *clips[t.clip];
+				fk.bones = clip.bones;
+				for( int f = t.begin; f < t.end; f++ ) {
+					float* out = &raw[size_t(first[t.clip] + f) * dim];
+					extract(clip, fk, f, out, scratch);
+					clipRaw[first[t.clip] + f] = t.clip;
+					frameRaw[first[t.clip] + f] = f;
+				}
+			}
+		});
+
+		// normalization: per dimension mean, one scale per feature group
+		mean.assign(dim, 0.f);
+		scale.assign(dim, 1.f);
+		if( size == 0 ) return;
+		std::vector<double> sum(dim, 0.0), sum2(dim, 0.0);
+		for( int i = 0; i < size; i++ )
+			for( int d = 0; d < dim; d++ ) {
+				double v = raw[size_t(i)*dim + d];
+				sum[d] += v;
+				sum2[d] += v*v;
+			}
+		for( int d = 0; d < dim; d++ ) mean[d] = float(sum[d] / size);
+		int nb = config.bones.size();
+		int groups[4][2] = { {0, 3*nb}, {3*nb, 6*nb}, {6*nb, dim}, {dim, dim} };
+		float weights[3] = { config.positionWeight, config.velocityWeight, config.trajectoryWeight };
+		for( int g = 0; g < 3; g++ ) {
+			int b = groups[g][0], e = groups[g][1];
+			if( e <= b ) continue;
+			double var = 0;
+			for( int d = b; d < e; d++ ) var += std::max(0.0, sum2[d]/size - double(mean[d])*mean[d]);
+			float s = float(std::sqrt(var / (e - b)));
+			if( s < 1e-6f ) s = 1.f;
+			for( int d = b; d < e; d++ ) scale[d] = weights[g] > 0 ? s / weights[g] : FLT_MAX;
+		}
+		for( int i = 0; i < size; i++ )
+			normalize(&raw[size_t(i)*dim], &raw[size_t(i)*dim]);
+
+		buildTree(raw, clipRaw, frameRaw, threads);
+	}
+
+	// Raw feature of clip frame f, in the layout described above. fk is a scratch copy of the skeleton.
+	void extract(const Body& clip, Body& fk, int f, float* out, std::vector<glm::vec3>& scratch) const {
+		int n = clip.Nframe;
+		int f1 = std::min(f + 1, n - 1), f0 = f1 == f ? std::max(f - 1, 0) : f;
+		float dt = clip.framerate > 0 ? clip.framerate * std::max(f1 - f0, 1) : 1.f;
+		int nb = config.bones.size();
+
+		// world positions at f0 and f1, velocity from their difference, facing frame of f
+		scratch.resize(2 * nb);
+		glm::vec3 root, fwd;
+		for( int pass = 0; pass < 2; pass++ ) {
+			int ff = pass == 0 ? f0 : f1;
+			fk.updateBone(clip.ValuesPerFrame[ff].data());
+			fk.update();
+			for( int i = 0; i < nb; i++ ) scratch[pass*nb + i] = fk.bones[config.bones[i]].gp;
+			if( ff == f ) facing(fk, root, fwd);
+		}
+		for( int i = 0; i < nb; i++ ) {
+			glm::vec3 p = toLocal((f == f0 ? scratch[i] : scratch[nb + i]) - root, fwd);
+			glm::vec3 v = toLocal((scratch[nb + i] - scratch[i]) / dt, fwd);
+			out[3*i] = p.x;  out[3*i+1] = p.y;  out[3*i+2] = p.z;
+			out[3*nb + 3*i] = v.x;  out[3*nb + 3*i+1] = v.y;  out[3*nb + 3*i+2] = v.z;
+		}
+		float* traj = out + 6*nb;
+		for( int j = 0; j < config.trajectoryFrames.size(); j++ ) {
+			int ff = std::min(f + config.trajectoryFrames[j], n - 1);
+			glm::vec3 tp = clip.bones[0].tr, tf;
+			glm::quat tq;
+			clip.bones[0].pose(clip.ValuesPerFrame[ff].data(), tp, tq);
+			tp = rotate(tq, clip.bones[0].offset) + tp;
+			tf = rotate(tq, glm::vec3(0,0,1));
+			glm::vec3 lp = toLocal(tp - root, fwd);
+			glm::vec3 lf = toLocal(tf, fwd);
+			float len = std::sqrt(lf.x*lf.x + lf.z*lf.z);
+			traj[4*j] = lp.x;
+			traj[4*j+1] = lp.z;
+			traj[4*j+2] = len > 1e-6f ? lf.x / len : 0.f;
+			traj[4*j+3] = len > 1e-6f ? lf.z / len : 1.f;
+		}
+	}
+
+	void normalize(const float* raw, float* out) const {
+		for( int d = 0; d < dim; d++ ) out[d] = (raw[d] - mean[d]) / scale[d];
+	}
+
+	// k nearest frames to a normalized query. maxLeaves > 0 bounds the number of visited leaves
+	// (approximate search with a fixed cost); 0 searches exactly. Returns the number of results.
+	int search(const float* query, int k, MatchResult* out, int maxLeaves = 0) const {
+		if( size == 0 || k <= 0 ) return 0;
+		k = std::min(k, size);
+		Heap heap{ out, 0, k };
+		int leaves = maxLeaves > 0 ? maxLeaves : INT32_MAX;
+		searchNode(0, 0, size, query, heap, leaves);
+		std::sort_heap(out, out + heap.n, Heap::less);
+		return heap.n;
+	}
+	MatchResult nearest(const float* query, int maxLeaves = 0) const {
+		MatchResult r;
+		search(query, 1, &r, maxLeaves);
+		return r;
+	}
+
+private:
+	std::vector<int> splitDim;		// implicit tree: node i has children 2i+1, 2i+2; -1 = leaf
+	std::vector<float> splitValue;
+
+	struct Heap {	// bounded max-heap on dist
+		MatchResult* a;
+		int n, k;
+		float worst() const { return n < k ? FLT_MAX : a[0].dist; }
+		void push(const MatchResult& r) {
+			if( n < k ) {
+				a[n++] = r;
+				std::push_heap(a, a + n, less);
+			}
+			else if( r.dist < a[0].dist ) {
+				std::pop_heap(a, a + n, less);
+				a[n-1] = r;
+				std::push_heap(a, a + n, less);
+			}
+		}
+		static bool less(const MatchResult& x, const MatchResult& y) { return x.dist < y.dist; }
+	};
+
+	template<typename F> static void parallel(int threads, F work) {
+		std::vector<std::thread> pool;
+		for( int t = 1; t < threads; t++ ) pool.emplace_back(work);
+		work();
+		for( auto& t : pool ) t.join();
+	}
+
+	static void facing(const Body& fk, glm::vec3& root, glm::vec3& fwd) {
+		root = fk.bones[0].gp;
+		fwd = rotate(fk.bones[0].gq, glm::vec3(0,0,1));
+		fwd.y = 0;
+		float l = glm::length(fwd);
+		fwd = l > 1e-6f ? fwd / l : glm::vec3(0,0,1);
+	}
+	static glm::vec3 toLocal(const glm::vec3& d, const glm::vec3& fwd) {
+		glm::vec3 right(fwd.z, 0, -fwd.x);
+		return glm::vec3(glm::dot(d, right), d.y, glm::dot(d, fwd));
+	}
+
+	void buildTree(const std::vector<float>& raw, const std::vector<int>& clipRaw, const std::vector<int>& frameRaw, int threads) {
+		int depth = 0;
+		while( (size >> depth) > LEAF_SIZE ) depth++;
+		splitDim.assign((2 << depth), -1);
+		splitValue.assign((2 << depth), 0.f);
+		std::vector<int> perm(size);
+		for( int i = 0; i < size; i++ ) perm[i] = i;
+		int parallelDepth = 0;
+		while( (1 << parallelDepth) < threads ) parallelDepth++;
+		buildNode(raw, perm, 0, 0, size, 0, parallelDepth);
+
+		features.resize(size_t(size) * dim);
+		clipOf.resize(size);
+		frameOf.resize(size);
+		for( int i = 0; i < size; i++ ) {
+			std::copy_n(&raw[size_t(perm[i])*dim], dim, &features[size_t(i)*dim]);
+			clipOf[i] = clipRaw[perm[i]];
+			frameOf[i] = frameRaw[perm[i]];
+		}
+	}
+	void buildNode(const std::vector<float>& raw, std::vector<int>& perm, int node, int begin, int end, int depth, int parallelDepth) {
+		if( end - begin <= LEAF_SIZE || node >= splitDim.size() ) return;
+		int best = 0;
+		float bestSpread = -1;
+		for( int d = 0; d < dim; d++ ) {
+			float lo = FLT_MAX, hi = -FLT_MAX;
+			for( int i = begin; i < end; i++ ) {
+				float v = raw[size_t(perm[i])*dim + d];
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+			}
+			if( hi - lo > bestSpread ) {
+				bestSpread = hi - lo;
+				best = d;
+			}
+		}
+		int mid = (begin + end) / 2;
+		std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end, [&](int a, int b) {
+			return raw[size_t(a)*dim + best] < raw[size_t(b)*dim + best];
+		});
+		splitDim[node] = best;
+		splitValue[node] = raw[size_t(perm[mid])*dim + best];
+		if( depth < parallelDepth ) {
+			std::thread left([&]{ buildNode(raw, perm, 2*node+1, begin, mid, depth+1, parallelDepth); });
+			buildNode(raw, perm, 2*node+2, mid, end, depth+1, parallelDepth);
+			left.join();
+		}
+		else {
+			buildNode(raw, perm, 2*node+1, begin, mid, depth+1, parallelDepth);
+			buildNode(raw, perm, 2*node+2, mid, end, depth+1, parallelDepth);
+		}
+	}
+	void searchNode(int node, int begin, int end, const float* q, Heap& heap, int& leaves) const {
+		if( leaves <= 0 ) return;
+		if( node >= splitDim.size() || splitDim[node] < 0 ) {
+			leaves--;
+			for( int i = begin; i < end; i++ ) {
+				const float* f = &features[size_t(i)*dim];
+				float worst = heap.worst();
+				float d2 = 0;
+				for( int d = 0; d < dim && d2 < worst; d++ ) {
+					float e = f[d] - q[d];
+					d2 += e*e;
+				}
+				if( d2 < worst ) heap.push({ clipOf[i], frameOf[i], d2 });
+			}
+			return;
+		}
+		int mid = (begin + end) / 2;
+		float diff = q[splitDim[node]] - splitValue[node];
+		if( diff < 0 ) {
+			searchNode(2*node+1, begin, mid, q, heap, leaves);
+			if( diff*diff < heap.worst() ) searchNode(2*node+2, mid, end, q, heap, leaves);
+		}
+		else {
+			searchNode(2*node+2, mid, end, q, heap, leaves);
+			if( diff*diff < heap.worst() ) searchNode(2*node+1, begin, mid, q, heap, leaves);
+		}
+	}
+};
+
+#endif
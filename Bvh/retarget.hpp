@@ -0,0 +1,185 @@
+#ifndef __RETARGET_HPP__
+#define __RETARGET_HPP__
+
+#include "bvh.hpp"
+#include <algorithm>
+#include <thread>
+#include <cstring>
+
+// Retargeting of Body motion between skeletons with different bone names and rest offsets.
+// build() resolves the bone correspondence and the rest pose alignment once; apply() then
+// works on index and quaternion arrays only. Rotations are transferred in global space:
+// G_target = G_source * restDelta, where restDelta turns the target bone's rest direction
+// onto the source bone's rest direction. Root translation is scaled by the skeleton heights.
+
+// Poses stored as root translation + local rotation per bone. Binary layout:
+// "BVHP", int bones, int frames, float frame time, then per frame vec3 + bones x quat(w,x,y,z).
+struct PoseClip {
+	int nBones = 0;
+	int Nframe = 0;
+	float framerate = 0.f;
+	std::vector<glm::vec3> rootTr;	// Nframe
+	std::vector<glm::quat> ro;		// Nframe x nBones
+
+	void resize(int bones, int frames) {
+		nBones = bones;
+		Nframe = frames;
+		rootTr.assign(frames, glm::vec3(0));
+		ro.assign(size_t(frames) * bones, glm::quat(1,0,0,0));
+	}
+	void applyFrame(Body& body, int f) const {
+		const glm::quat* q = &ro[size_t(f) * nBones];
+		for( int b = 0; b < nBones && b < body.bones.size(); b++ ) body.bones[b].ro = q[b];
+		if( !body.bones.empty() ) body.bones[0].tr = rootTr[f];
+	}
+	bool save(const std::string& fn) const {
+		std::ofstream os(fn, std::ios::binary);
+		if( !os ) return false;
+		os.write("BVHP", 4);
+		os.write((const char*)&nBones, sizeof(int));
+		os.write((const char*)&Nframe, sizeof(int));
+		os.write((const char*)&framerate, sizeof(float));
+		std::vector<float> row(3 + 4 * nBones);
+		for( int f = 0; f < Nframe; f++ ) {
+			packRow(f, row.data());
+			os.write((const char*)row.data(), row.size() * sizeof(float));
+		}
+		return bool(os);
+	}
+	bool load(const std::string& fn) {
+		std::ifstream is(fn, std::ios::binary);
+		char magic[4];
+		int bones = 0, frames = 0;
+		is.read(magic, 4);
+		if( !is || std::memcmp(magic, "BVHP", 4) != 0 ) return false;
+		is.read((char*)&bones, sizeof(int));
+		is.read((char*)&frames, sizeof(int));
+		is.read((char*)&framerate, sizeof(float));
+		if( !is || bones < 0 || frames < 0 ) return false;
+		resize(bones, frames);
+		std::vector<float> row(3 + 4 * nBones);
+		for( int f = 0; f < Nframe; f++ ) {
+			is.read((char*)row.data(), row.size() * sizeof(float));
+			rootTr[f] = glm::vec3(row[0], row[1], row[2]);
+			for( int b = 0; b < nBones; b++ )
+				ro[size_t(f)*nBones + b] = glm::quat(row[3+4*b], row[4+4*b], row[5+4*b], row[6+4*b]);
+		}
+		return bool(is);
+	}
+private:
+	void packRow(int f, float* row) const {
+		row[0] = rootTr[f].x; row[1] = rootTr[f].y; row[2] = rootTr[f].z;
+		for( int b = 0; b < nBones; b++ ) {
+			const glm::quat& q = ro[size_t(f)*nBones + b];
+			row[3+4*b] = q.w; row[4+4*b] = q.x; row[5+4*b] = q.y; row[6+4*b] = q.z;
+		}
+	}
+};
+
+struct Retargeter {
+	std::vector<int> sourceOf;			// per target bone, -1 if unmapped
+	std::vector<glm::quat> restDelta;	// per target bone
+	float rootScale = 1.f;
+
+	// names: (source bone, target bone) pairs; bones with the same name are matched as well.
+	void build(const Body& source, const Body& target, const std::vector<std::pair<std::string, std::string>>& names = {}) {
+		int nt = target.bones.size();
+		sourceOf.assign(nt, -1);
+		restDelta.assign(nt, glm::quat(1,0,0,0));
+		for( int t = 0; t < nt; t++ ) {
+			sourceOf[t] = findBone(source, target.bones[t].name);
+			for( auto& p : names )
+				if( p.second == target.bones[t].name ) sourceOf[t] = findBone(source, p.first);
+		}
+		std::vector<glm::vec3> srcRest = restPositions(source), tgtRest = restPositions(target);
+		// rest direction of each mapped bone: toward its first mapped child, else its first child
+		for( int t = 0; t < nt; t++ ) {
+			int s = sourceOf[t];
+			if( s < 0 ) continue;
+			int child = -1;
+			for( int c = t+1; c < nt; c++ ) {
+				if( target.bones[c].parent != t ) continue;
+				if( child < 0 || (sourceOf[child] < 0 && sourceOf[c] >= 0) ) child = c;
+			}
+			if( child < 0 ) continue;
+			glm::vec3 tgtDir = tgtRest[child] - tgtRest[t];
+			glm::vec3 srcDir;
+			if( sourceOf[child] >= 0 ) srcDir = srcRest[sourceOf[child]] - srcRest[s];
+			else {
+				int sc = -1;
+				for( int c = s+1; c < source.bones.size() && sc < 0; c++ )
+					if( source.bones[c].parent == s ) sc = c;
+				if( sc < 0 ) continue;
+				srcDir = srcRest[sc] - srcRest[s];
+			}
+			restDelta[t] = rotationBetween(tgtDir, srcDir);
+		}
+		float hs = height(srcRest), ht = height(tgtRest);
+		rootScale = hs > 1e-6f ? ht / hs : 1.f;
+	}
+
+	// source must be posed and updated (Body::update); writes target tr/ro, call target.update() after.
+	void apply(const Body& source, Body& target) const {
+		int nt = target.bones.size();
+		for( int t = 0; t < nt; t++ ) {
+			Bone& b = target.bones[t];
+			glm::quat parentG = b.parent >= 0 ? target.bones[b.parent].gq : glm::quat(1,0,0,0);
+			int s = sourceOf[t];
+			b.gq = s >= 0 ? source.bones[s].gq * restDelta[t] : parentG;	// gq used as scratch, update() rewrites it
+			b.ro = glm::normalize(inverse(parentG) * b.gq);
+		}
+		if( nt > 0 && sourceOf[0] >= 0 ) target.bones[0].tr = source.bones[sourceOf[0]].tr * rootScale;
+	}
+
+	// Offline: retargets every frame of sourceClip onto target's skeleton, frames split over threads.
+	void retargetClip(const Body& sourceClip, const Body& target, PoseClip& out, int threads = 0) const {
+		out.resize(target.bones.size(), sourceClip.Nframe);
+		out.framerate = sourceClip.framerate;
+		if( threads <= 0 ) threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = std::max(1, std::min(threads, sourceClip.Nframe / 64));
+		auto work = [&](int begin, int end) {
+			Body src, tgt;
+			src.bones = sourceClip.bones;
+			tgt.bones = target.bones;
+			for( int f = begin; f < end; f++ ) {
+				src.updateBone(sourceClip.ValuesPerFrame[f].data());
+				src.update();
+				apply(src, tgt);
+				for( int b = 0; b < out.nBones; b++ ) out.ro[size_t(f)*out.nBones + b] = tgt.bones[b].ro;
+				if( out.nBones > 0 ) out.rootTr[f] = tgt.bones[0].tr;
+			}
+		};
+		std::vector<std::thread> pool;
+		int per = (sourceClip.Nframe + threads - 1) / std::max(threads, 1);
+		for( int t = 1; t < threads; t++ )
+			pool.emplace_back(work, std::min(t * per, sourceClip.Nframe), std::min((t+1) * per, sourceClip.Nframe));
+		work(0, std::min(per, sourceClip.Nframe));
+		for( auto& th : pool ) th.join();
+	}
+
+private:
+	static int findBone(const Body& body, const std::string& name) {
+		for( int i = 0; i < body.bones.size(); i++ )
+			if( body.bones[i].name == name ) return i;
+		return -1;
+	}
+	static std::vector<glm::vec3> restPositions(const Body& body) {
+		std::vector<glm::vec3> p(body.bones.size());
+		for( int i = 0; i < body.bones.size(); i++ ) {
+			int parent = body.bones[i].parent;
+			p[i] = body.bones[i].offset + (parent >= 0 ? p[parent] : glm::vec3(0));
+		}
+		return p;
+	}
+	static float height(const std::vector<glm::vec3>& p) {
+		if( p.empty() ) return 0.f;
+		float lo = p[0].y, hi = p[0].y;
+		for( auto& x : p ) {
+			lo = std::min(lo, x.y);
+			hi = std::max(hi, x.y);
+		}
+		return hi - lo;
+	}
+};
+
+#endif
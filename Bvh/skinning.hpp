@@ -0,0 +1,287 @@
+#ifndef __SKINNING_HPP__
+#define __SKINNING_HPP__
+
+#include "bvh.hpp"
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// CPU mesh skinning driven by the global bone transforms (gp/gq) of Body::update.
+// Vertices and bone transforms are both stored as structure of arrays: one array per vertex
+// component and one row of nb floats per matrix or dual quaternion element. The kernels
+// work on blocks of BLOCK vertices in two passes. The blend pass walks the influences and
+// adds weight * row[bone] to every element of the block's blended transforms; these per
+// row lookups are the only indexed loads. The transform pass then applies the blended
+// transforms with unit-stride loads and stores only.
+// Both are marked SKIN_SIMD, which is `omp simd` when OpenMP is on (-fopenmp, or
+// -fopenmp-simd -DSKIN_OMP_SIMD) and empty otherwise; add -fno-math-errno for the sqrt in
+// the DQS pass and check with -fopt-info-vec. Large meshes are split into chunks over a pool of persistent workers.
+
+#if defined(_OPENMP) || defined(SKIN_OMP_SIMD)
+#define SKIN_SIMD _Pragma("omp simd")
+#else
+#define SKIN_SIMD
+#endif
+
+struct SkinMesh {
+	static const int MAX_INFLUENCES = 4;
+	int n = 0;
+	std::vector<float> px, py, pz;	// bind pose positions
+	std::vector<float> nx, ny, nz;	// bind pose normals
+	std::vector<uint16_t> bone[MAX_INFLUENCES];
+	std::vector<float> weight[MAX_INFLUENCES];	// unused influences have weight 0
+
+	void resize(int count) {
+		n = count;
+		for( auto v : { &px, &py, &pz, &nx, &ny, &nz } ) v->assign(n, 0.f);
+		for( int k = 0; k < MAX_INFLUENCES; k++ ) {
+			bone[k].assign(n, 0);
+			weight[k].assign(n, 0.f);
+		}
+	}
+	void normalizeWeights() {
+		for( int i = 0; i < n; i++ ) {
+			float s = 0;
+			for( int k = 0; k < MAX_INFLUENCES; k++ ) s += weight[k][i];
+			if( s > 0 ) for( int k = 0; k < MAX_INFLUENCES; k++ ) weight[k][i] /= s;
+			else weight[0][i] = 1;
+		}
+	}
+};
+
+struct SkinOutput {
+	std::vector<float> px, py, pz;
+	std::vector<float> nx, ny, nz;
+	void resize(int n) {
+		for( auto v : { &px, &py, &pz, &nx, &ny, &nz } ) v->resize(n);
+	}
+};
+
+struct Skinner {
+	int threads = 0;			// 0: all cores
+	int chunk = 8192;			// vertices per task
+
+	Skinner() = default;
+	Skinner(const Skinner&) = delete;
+	Skinner& operator=(const Skinner&) = delete;
+	~Skinner() { stopWorkers(); }
+
+	// Records the bind pose: call with the body posed as the mesh was modelled (after Body::update).
+	void bind(const Body& body) {
+		nb = body.bones.size();
+		bindGp.resize(nb);
+		bindGq.resize(nb);
+		for( int b = 0; b < nb; b++ ) {
+			bindGp[b] = body.bones[b].gp;
+			bindGq[b] = body.bones[b].gq;
+		}
+		mats.assign(12 * nb, 0.f);
+		dqs.assign(8 * nb, 0.f);
+	}
+	// Per bone skinning transforms for the current pose (after Body::update).
+	void setPose(const Body& body) {
+		int n = std::min<int>(body.bones.size(), nb);
+		for( int b = 0; b < n; b++ ) {
+			glm::quat q = glm::normalize(body.bones[b].gq * inverse(bindGq[b]));
+			glm::vec3 t = body.bones[b].gp - rotate(q, bindGp[b]);
+			// 3x4 row major
+			float xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+			float xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+			float wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+			float m[12] = {
+				1-2*(yy+zz),	2*(xy-wz),		2*(xz+wy),		t.x,
+				2*(xy+wz),		1-2*(xx+zz),	2*(yz-wx),		t.y,
+				2*(xz-wy),		2*(yz+wx),		1-2*(xx+yy),	t.z };
+			for( int j = 0; j < 12; j++ ) mats[j * nb + b] = m[j];
+			// dual quaternion: real q, dual 0.5 * (0,t) * q
+			glm::quat d = glm::quat(0, t) * q * 0.5f;
+			float dq[8] = { q.w, q.x, q.y, q.z, d.w, d.x, d.y, d.z };
+			for( int j = 0; j < 8; j++ ) dqs[j * nb + b] = dq[j];
+		}
+	}
+
+	void skinLBS(const SkinMesh& mesh, SkinOutput& out) {
+		out.resize(mesh.n);
+		parallel(mesh.n, [&](int b, int e) { lbs(mesh, out, b, e); });
+	}
+	void skinDQS(const SkinMesh& mesh, SkinOutput& out) {
+		out.resize(mesh.n);
+		parallel(mesh.n, [&](int b, int e) { dqsKernel(mesh, out, b, e); });
+	}
+
+private:
+	static const int BLOCK = 64;	// vertices per kernel pass, small enough for the scratch to stay in L1
+	int nb = 0;
+	std::vector<glm::vec3> bindGp;
+	std::vector<glm::quat> bindGq;
+	std::vector<float> mats;	// 12 rows of nb: element j of bone b's 3x4 matrix at [j*nb + b]
+	std::vector<float> dqs;		// 8 rows of nb: real w,x,y,z then dual w,x,y,z
+
+	// Worker pool, started on the first parallel call and kept until the thread count changes.
+	std::vector<std::thread> pool;
+	std::mutex mtx;
+	std::condition_variable wake, done;
+	std::function<void(int,int)> job;
+	int jobN = 0, jobTasks = 0;
+	std::atomic<int> nextTask { 0 };
+	int busy = 0;				// workers still on the current job
+	long long generation = 0;	// bumped per job
+	bool quit = false;
+
+	template<typename F> void parallel(int n, F kernel) {
+		int nt = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+		int tasks = (n + chunk - 1) / chunk;
+		nt = std::max(1, std::min(nt, tasks));
+		if( nt == 1 ) {
+			kernel(0, n);
+			return;
+		}
+		startWorkers(nt - 1);	// the calling thread takes tasks too
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			job = kernel;
+			jobN = n;
+			jobTasks = tasks;
+			nextTask = 0;
+			busy = pool.size();
+			generation++;
+		}
+		wake.notify_all();
+		runTasks();
+		std::unique_lock<std::mutex> lock(mtx);
+		done.wait(lock, [this]() { return busy == 0; });
+	}
+	void runTasks() {
+		for( int c = nextTask++; c < jobTasks; c = nextTask++ )
+			job(c * chunk, std::min(jobN, (c+1) * chunk));
+	}
+	void workerLoop(long long seen) {
+		std::unique_lock<std::mutex> lock(mtx);
+		for( ;; ) {
+			wake.wait(lock, [&]() { return quit || generation != seen; });
+			if( quit ) return;
+			seen = generation;
+			lock.unlock();
+			runTasks();
+			lock.lock();
+			if( --busy == 0 ) done.notify_one();
+		}
+	}
+	void startWorkers(int count) {
+		if( (int)pool.size() == count ) return;
+		stopWorkers();
+		quit = false;
+		for( int t = 0; t < count; t++ ) pool.emplace_back(&Skinner::workerLoop, this, generation);
+	}
+	void stopWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		wake.notify_all();
+		for( auto& th : pool ) th.join();
+		pool.clear();
+	}
+
+	void lbs(const SkinMesh& mesh, SkinOutput& out, int begin, int end) const {
+		float m[12][BLOCK];
+		const float* R[12];
+		for( int j = 0; j < 12; j++ ) R[j] = &mats[j * nb];
+		for( int i0 = begin; i0 < end; i0 += BLOCK ) {
+			int len = std::min(BLOCK, end - i0);
+			const uint16_t* bone = &mesh.bone[0][i0];
+			const float* w = &mesh.weight[0][i0];
+			SKIN_SIMD
+			for( int i = 0; i < len; i++ ) {
+				int b = bone[i];
+				for( int j = 0; j < 12; j++ ) m[j][i] = w[i] * R[j][b];
+			}
+			for( int k = 1; k < SkinMesh::MAX_INFLUENCES; k++ ) {
+				bone = &mesh.bone[k][i0];
+				w = &mesh.weight[k][i0];
+				SKIN_SIMD
+				for( int i = 0; i < len; i++ ) {
+					int b = bone[i];
+					for( int j = 0; j < 12; j++ ) m[j][i] += w[i] * R[j][b];
+				}
+			}
+			const float *px = &mesh.px[i0], *py = &mesh.py[i0], *pz = &mesh.pz[i0];
+			const float *nx = &mesh.nx[i0], *ny = &mesh.ny[i0], *nz = &mesh.nz[i0];
+			float *opx = &out.px[i0], *opy = &out.py[i0], *opz = &out.pz[i0];
+			float *onx = &out.nx[i0], *ony = &out.ny[i0], *onz = &out.nz[i0];
+			SKIN_SIMD
+			for( int i = 0; i < len; i++ ) {
+				float x = px[i], y = py[i], z = pz[i];
+				opx[i] = m[0][i]*x + m[1][i]*y + m[2][i]*z + m[3][i];
+				opy[i] = m[4][i]*x + m[5][i]*y + m[6][i]*z + m[7][i];
+				opz[i] = m[8][i]*x + m[9][i]*y + m[10][i]*z + m[11][i];
+				x = nx[i]; y = ny[i]; z = nz[i];
+				onx[i] = m[0][i]*x + m[1][i]*y + m[2][i]*z;
+				ony[i] = m[4][i]*x + m[5][i]*y + m[6][i]*z;
+				onz[i] = m[8][i]*x + m[9][i]*y + m[10][i]*z;
+			}
+		}
+	}
+
+	void dqsKernel(const SkinMesh& mesh, SkinOutput& out, int begin, int end) const {
+		float d[8][BLOCK];
+		float q0[4][BLOCK];		// real part of the first influence
+		const float* R[8];
+		for( int j = 0; j < 8; j++ ) R[j] = &dqs[j * nb];
+		for( int i0 = begin; i0 < end; i0 += BLOCK ) {
+			int len = std::min(BLOCK, end - i0);
+			const uint16_t* bone = &mesh.bone[0][i0];
+			const float* w = &mesh.weight[0][i0];
+			SKIN_SIMD
+			for( int i = 0; i < len; i++ ) {
+				int b = bone[i];
+				for( int j = 0; j < 4; j++ ) q0[j][i] = R[j][b];
+				for( int j = 0; j < 8; j++ ) d[j][i] = w[i] * R[j][b];
+			}
+			for( int k = 1; k < SkinMesh::MAX_INFLUENCES; k++ ) {
+				bone = &mesh.bone[k][i0];
+				w = &mesh.weight[k][i0];
+				SKIN_SIMD
+				for( int i = 0; i < len; i++ ) {
+					int b = bone[i];
+					// keep every influence in the hemisphere of the first one
+					float dot = q0[0][i]*R[0][b] + q0[1][i]*R[1][b] + q0[2][i]*R[2][b] + q0[3][i]*R[3][b];
+					float s = dot < 0 ? -w[i] : w[i];
+					for( int j = 0; j < 8; j++ ) d[j][i] += s * R[j][b];
+				}
+			}
+			const float *px = &mesh.px[i0], *py = &mesh.py[i0], *pz = &mesh.pz[i0];
+			const float *nx = &mesh.nx[i0], *ny = &mesh.ny[i0], *nz = &mesh.nz[i0];
+			float *opx = &out.px[i0], *opy = &out.py[i0], *opz = &out.pz[i0];
+			float *onx = &out.nx[i0], *ony = &out.ny[i0], *onz = &out.nz[i0];
+			SKIN_SIMD
+			for( int i = 0; i < len; i++ ) {
+				float inv = 1.f / std::sqrt(d[0][i]*d[0][i] + d[1][i]*d[1][i] + d[2][i]*d[2][i] + d[3][i]*d[3][i]);
+				float w = d[0][i]*inv, rx = d[1][i]*inv, ry = d[2][i]*inv, rz = d[3][i]*inv;
+				float tw = d[4][i]*inv, tx = d[5][i]*inv, ty = d[6][i]*inv, tz = d[7][i]*inv;
+				// translation = 2 * (dual * conj(real)).xyz
+				float Tx = 2 * (-tw*rx + tx*w - ty*rz + tz*ry);
+				float Ty = 2 * (-tw*ry + tx*rz + ty*w - tz*rx);
+				float Tz = 2 * (-tw*rz - tx*ry + ty*rx + tz*w);
+
+				float x = px[i], y = py[i], z = pz[i];
+				// v' = v + 2 r x (r x v + w v)
+				float cx = ry*z - rz*y + w*x, cy = rz*x - rx*z + w*y, cz = rx*y - ry*x + w*z;
+				opx[i] = x + 2 * (ry*cz - rz*cy) + Tx;
+				opy[i] = y + 2 * (rz*cx - rx*cz) + Ty;
+				opz[i] = z + 2 * (rx*cy - ry*cx) + Tz;
+				x = nx[i]; y = ny[i]; z = nz[i];
+				cx = ry*z - rz*y + w*x; cy = rz*x - rx*z + w*y; cz = rx*y - ry*x + w*z;
+				onx[i] = x + 2 * (ry*cz - rz*cy);
+				ony[i] = y + 2 * (rz*cx - rx*cz);
+				onz[i] = z + 2 * (rx*cy - ry*cx);
+			}
+		}
+	}
+};
+
+#endif
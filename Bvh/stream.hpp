@@ -0,0 +1,189 @@
+#ifndef __STREAM_HPP__
+#define __STREAM_HPP__
+
+#include "bvh.hpp"
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+// Streaming playback of BVH clips that do not fit in memory.
+// open() reads the hierarchy into `body` (ValuesPerFrame stays empty) and scans the
+// MOTION section once, remembering the byte offset of every INDEX_STRIDE-th frame row.
+// A worker thread keeps a ring of decoded frames around the playhead, filling ahead of it.
+// Memory is the ring plus Nframe/INDEX_STRIDE offsets.
+
+struct BvhStream {
+	static const int INDEX_STRIDE = 64;
+
+	Body body;
+	int capacity = 0;	// frames in the ring
+	int ahead = 0;		// frames decoded past the playhead
+
+	BvhStream() {}
+	BvhStream(const BvhStream&) = delete;
+	BvhStream& operator=(const BvhStream&) = delete;
+	~BvhStream() {
+		close();
+	}
+
+	bool open( const std::string& fn, int ringFrames = 256 ) {
+		close();
+		fileName = fn;
+		std::ifstream is(fn, std::ios::binary);
+		if( !is ) return false;
+		body.clear();	// keeps the caller's verbose setting
+		if( !body.readHierarchy(is) ) return false;
+		std::getline(is, line); // rest of the Frame Time line
+		if( !buildIndex(is) ) return false;
+
+		capacity = std::max(2, std::min(ringFrames, std::max(body.Nframe, 2)));
+		ahead = capacity * 3 / 4;
+		ring.assign(size_t(capacity) * body.Nchannel, 0.f);
+		slotFrame.assign(capacity, -1);
+		playhead = 0;
+		quit = false;
+		worker = std::thread(&BvhStream::run, this);
+		return true;
+	}
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			quit = true;
+		}
+		wake.notify_all();
+		if( worker.joinable() ) worker.join();
+		in.close();
+	}
+
+	int getNFrames() const {
+		return body.Nframe;
+	}
+	float getFrameRate() const {
+		return body.framerate;
+	}
+
+	// Copies frame f into out (Nchannel floats), waiting for the worker if it is not decoded yet.
+	void getFrame( int f, float* out ) {
+		f = glm::clamp(f, 0, body.Nframe-1);
+		std::unique_lock<std::mutex> lock(mtx);
+		if( f != playhead ) {
+			playhead = f;
+			wake.notify_all();
+		}
+		int slot = f % capacity;
+		if( slotFrame[slot] != f ) misses++;
+		ready.wait(lock, [&]{ return slotFrame[slot] == f || quit; });
+		std::memcpy(out, &ring[size_t(slot) * body.Nchannel], body.Nchannel * sizeof(float));
+	}
+	// Same as Body::updateBone(framecount) for a streamed clip.
+	void updateBone( int f ) {
+		row.resize(body.Nchannel);
+		getFrame(f, row.data());
+		body.updateBone(row.data());
+	}
+
+	int misses = 0;		// getFrame calls that had to wait for the worker
+
+private:
+	std::string fileName;
+	std::string line;
+	std::ifstream in;
+	int streamFrame = -1;	// frame row the worker stream is positioned at
+	std::vector<uint64_t> index;
+	std::vector<float> ring;
+	std::vector<int> slotFrame;
+	std::vector<float> row;
+	int playhead = 0;
+	bool quit = false;
+	std::mutex mtx;
+	std::condition_variable wake, ready;
+	std::thread worker;
+
+	bool buildIndex( std::istream& is ) {
+		index.clear();
+		uint64_t pos = uint64_t(is.tellg());
+		std::vector<char> buf(1<<20);
+		int frame = 0;
+		bool lineStart = true;
+		while( frame < body.Nframe && is ) {
+			is.read(buf.data(), buf.size());
+			std::streamsize n = is.gcount();
+			for( std::streamsize i = 0; i < n && frame < body.Nframe; i++, pos++ ) {
+				char c = buf[i];
+				if( c == '\n' || c == '\r' ) {
+					lineStart = true;
+				}
+				else if( lineStart && c != ' ' && c != '\t' ) { // first character of a frame row
+					if( frame % INDEX_STRIDE == 0 ) index.push_back(pos);
+					frame++;
+					lineStart = false;
+				}
+			}
+		}
+		if( frame < body.Nframe ) {
+			std::cerr << fileName << ": expected " << body.Nframe << " frames, found " << frame << std::endl;
+			body.Nframe = frame;
+		}
+		return body.Nframe > 0;
+	}
+
+	// Parses frame f into out, seeking through the sparse index only when not reading sequentially.
+	void decode( int f, float* out ) {
+		if( f != streamFrame ) {
+			in.clear();
+			in.seekg(index[f / INDEX_STRIDE]);
+			for( int i = f - f % INDEX_STRIDE; i < f; i++ ) nextRow();
+		}
+		nextRow();
+		const char* p = line.c_str();
+		for( int c = 0; c < body.Nchannel; c++ ) {
+			char* end;
+			out[c] = std::strtof(p, &end);
+			p = end;
+		}
+		streamFrame = f + 1;
+	}
+	void nextRow() {
+		do std::getline(in, line);
+		while( in && line.find_first_not_of(" \t\r") == std::string::npos );
+	}
+
+	void run() {
+		in.open(fileName, std::ios::binary);
+		streamFrame = -1;
+		std::vector<float> tmp(body.Nchannel);
+		std::unique_lock<std::mutex> lock(mtx);
+		while( !quit ) {
+			// nearest frame in [playhead, playhead+ahead) that is not in the ring
+			int target = -1;
+			int last = std::min(playhead + ahead, body.Nframe);
+			for( int f = playhead; f < last; f++ ) {
+				if( slotFrame[f % capacity] != f ) {
+					target = f;
+					break;
+				}
+			}
+			if( target < 0 ) {
+				wake.wait(lock);
+				continue;
+			}
+			lock.unlock();
+			decode(target, tmp.data());
+			lock.lock();
+			// a seek may have moved the window while we were decoding
+			if( target >= playhead && target < playhead + ahead ) {
+				int slot = target % capacity;
+				std::memcpy(&ring[size_t(slot) * body.Nchannel], tmp.data(), body.Nchannel * sizeof(float));
+				slotFrame[slot] = target;
+				if( target == playhead ) ready.notify_all();
+			}
+		}
+		ready.notify_all();
+	}
+};
+
+#endif
@@ -9,6 +9,9 @@
 #include <JGL/JGL_Window.hpp>
 #include "AnimView.hpp"
 #include <glm/gtx/quaternion.hpp>
+#include "simrunner.hpp"
+#include "Bvh/bvh.hpp"
+#include "Bvh/colliders.hpp"
 
 using namespace glm;
 
@@ -125,13 +128,26 @@ struct Sphere {
 float randf() {
 	return rand()/(float)RAND_MAX;
 }
-bool fix0 = true, fix1 = true;
+std::atomic<bool> fix0 { true }, fix1 { true };	// toggled on the UI thread, read by the simulation
+
+struct ClothSnapshot {
+	std::vector<vec3> particles;
+	std::vector<vec3> capsules;	// endpoint pairs
+};
+SimRunner<ClothSnapshot> runner;
+void printStats() {
+	SimStats s = runner.stats();
+	std::cout << s.steps << " steps, " << s.late << " late, " << s.skipped << " skipped, "
+			  << s.unseen << " never drawn, step " << s.meanStepMs << " ms avg " << s.maxStepMs << " ms max" << std::endl;
+}
 
 void keyFunc(int key) {
 	if( key == '1' )
 		fix0=!fix0;
 	if( key == '2' )
 		fix1=!fix1;
+	if( key == 'p' )
+		printStats();
 }
 
 const vec3 G ( 0, -980.f, 0 );
@@ -141,8 +157,47 @@ std::vector<Spring> springs;
 Plane flooring( {0,0,0}, {0,1,0} );
 Sphere sphere(30, { 0,30,-5 });
 const int count = 20;
+std::vector<std::pair<int,int>> springEnds;	// particle indices, for drawing from a snapshot
+
+// Optional mocap character the cloth collides with, given on the command line.
+Body character;
+CapsuleColliders colliders;
+bool hasCharacter = false;
+float scaleArg = 0, radiusArg = 0;	// -s, -r; 0: derived in placeCharacter()
+float capsuleRadius = 0;
+float characterTime = 0;
+int characterFrame = 0;
+std::vector<vec3> substepStart;	// particle positions before the current substep
+
+// Scales the character to stand just under the cloth (unless -s), feet on the floor and
+// centered below it, and sizes the capsules from its bone lengths (unless -r).
+void placeCharacter() {
+	character.updateBone( 0 );
+	character.update();
+	vec3 lo = character.bones[0].gp, hi = lo;
+	for( auto& b : character.bones ) {
+		lo = min( lo, b.gp );
+		hi = max( hi, b.gp );
+	}
+	float top = particles.front().x.y;	// lowest row of the cloth
+	float height = hi.y - lo.y;
+	colliders.scale = scaleArg > 0 ? scaleArg : height > 0 ? 0.95f * top / height : 1.f;
+	vec3 clothCenter = ( particles.front().x + particles[count - 1].x ) / 2.f;
+	vec3 feet = vec3( (lo.x + hi.x) / 2, lo.y, (lo.z + hi.z) / 2 ) * colliders.scale;
+	colliders.offset = vec3( clothCenter.x, 0, clothCenter.z ) - feet;
+	capsuleRadius = radiusArg;
+	if( capsuleRadius <= 0 ) {
+		std::vector<float> lengths;
+		for( auto& b : character.bones )
+			if( b.parent >= 0 ) lengths.push_back( length( b.gp - character.bones[b.parent].gp ) * colliders.scale );
+		std::sort( lengths.begin(), lengths.end() );
+		capsuleRadius = lengths.empty() ? 1.f : std::max( 0.5f, 0.4f * lengths[lengths.size() / 2] );
+	}
+}
 
+void simulate( float dt );
 void init() {
+	runner.stop();
 	particles.clear();
 	springs.clear();
 	for (int y= 0; y < count; y++) {
@@ -170,12 +225,45 @@ void init() {
 			springs.push_back(Spring(particles[y * count + (x + 1)], particles[(y + 1) * count + x]));
 		}
 	}
+	springEnds.clear();
+	for( auto& s : springs ) springEnds.push_back({ int(&s.a - particles.data()), int(&s.b - particles.data()) });
+	substepStart.resize( particles.size() );
+	characterTime = 0;
+	characterFrame = 0;
+	if( hasCharacter ) {
+		placeCharacter();
+		colliders.build( character, capsuleRadius );
+	}
+	runner.start( simulate, []( ClothSnapshot& snapshot ) {
+		snapshot.particles.resize( particles.size() );
+		for( size_t i = 0; i < particles.size(); i++ ) snapshot.particles[i] = particles[i].x;
+		snapshot.capsules.clear();
+		for( auto& c : colliders.capsules ) {
+			snapshot.capsules.push_back( c.p0 );
+			snapshot.capsules.push_back( c.p1 );
+		}
+	} );
 }
-void frame( float dt ) {
+
+// Runs on the simulation thread.
+void simulate( float dt ) {
 	const int steps =150;
 
+	if( hasCharacter ) {
+		characterTime += dt;
+		int f = int( characterTime / character.getFrameRate() ) % character.getNFrames();
+		if( f < characterFrame ) colliders.reset();	// looped: jump back, don't sweep through the scene
+		characterFrame = f;
+		character.updateBone( f );
+		character.update();
+		colliders.update( character, dt );
+	}
 	for (int i = 0; i<steps; i++)
 	{
+		if( hasCharacter ) {
+			colliders.setSubstep( (i + 1) / float(steps) );
+			for( size_t j = 0; j < particles.size(); j++ ) substepStart[j] = particles[j].x;
+		}
 		vec3 p0 = particles[(count - 1) * count].x;
 		vec3 p1 = particles[count * count -1].x;
 		for (auto& p : particles) p.clearForce();
@@ -185,6 +273,8 @@ void frame( float dt ) {
 		for (auto& p : particles) p.update(dt / steps);
 		for (auto& p : particles) flooring.resolveCollision(p);
 		for (auto& p : particles) sphere.resolveCollision(p,dt/steps);
+		if( hasCharacter )
+			for( size_t j = 0; j < particles.size(); j++ ) colliders.resolve( particles[j].x, particles[j].v, substepStart[j] );
 		if (fix0) {
 			particles[(count - 1) * count].x = p0;
 			particles[(count - 1) * count].v = {0,0,0};
@@ -198,15 +288,35 @@ void frame( float dt ) {
 	
 }
 
+void frame( float dt ) {
+	runner.request( dt );
+}
+
 void render() {
-	for( auto& p : particles ) p.draw();
-	for( auto& s : springs )   s.draw();
+	const ClothSnapshot* snap = runner.latest();
+	if( snap ) {
+		const std::vector<vec3>& x = snap->particles;
+		for( auto& p : x ) drawSphere( p, 1 );
+		for( auto& e : springEnds ) drawCylinder( x[e.first], x[e.second], 0.4, glm::vec4(0,1,.4,1) );
+		for( size_t i = 0; i + 1 < snap->capsules.size(); i += 2 )
+			drawCylinder( snap->capsules[i], snap->capsules[i+1], capsuleRadius, glm::vec4(1,0.6,0.2,1) );
+	}
 	flooring.draw();
 	sphere.draw();
 
 }
 
+// usage: ClothSimulation [-s scale] [-r capsule radius] [character.bvh]
 int main(int argc, const char * argv[]) {
+	for( int i = 1; i < argc; i++ ) {
+		std::string a = argv[i];
+		if( a == "-s" && i+1 < argc ) scaleArg = atof( argv[++i] );
+		else if( a == "-r" && i+1 < argc ) radiusArg = atof( argv[++i] );
+		else {
+			character.verbose = false;
+			hasCharacter = character.readBVH( a ) && character.getNFrames() > 0 && character.getFrameRate() > 0;
+		}
+	}
 	JGL::Window* window = new JGL::Window(800,600,"simulation");
 	window->alignment(JGL::ALIGN_ALL);
 	AnimView* animView = new AnimView(0,0,800,600);
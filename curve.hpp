@@ -0,0 +1,1002 @@
+#ifndef __CURVE_HPP__
+#define __CURVE_HPP__
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+using glm::vec2;
+
+enum {
+	LAGLANGIAN,
+	LINEAR,
+	BEZIER,
+	HERMITE,
+	CATMULL,
+	OVERHAUSER,
+	OVERHAUSER2,
+	BSPLINE,
+	NATURAL,
+	NATURAL_CLOSED,
+	LAGLANGIAN_CHEBYSHEV
+};
+
+template<typename T> inline T Bezier(const T& p0, const T& p1, const T& p2, const T& p3, float t) {
+	float t1 = 1 - t;
+	return t1 * t1 * t1 * p0 + 3 * t1 * t1 * t * p1 + 3 * t1 * t * t * p2 + t * t * t * p3;
+}
+
+
+// Thomas algorithm: solves a tridiagonal system in O(n), all components of P together.
+// a: sub-diagonal (a[0] unused), b: diagonal, c: super-diagonal (c[n-1] unused).
+// d holds the right hand side on entry and the solution on return.
+template<typename P, typename S>
+inline void solveTridiagonal( const std::vector<S>& a, const std::vector<S>& b, const std::vector<S>& c, std::vector<P>& d ) {
+	int n = d.size();
+	std::vector<S> cp(n);
+	cp[0] = c[0] / b[0];
+	d[0] = d[0] / b[0];
+	for( int i = 1; i < n; i++ ) {
+		S m = S(1) / (b[i] - a[i] * cp[i - 1]);
+		cp[i] = c[i] * m;
+		d[i] = (d[i] - a[i] * d[i - 1]) * m;
+	}
+	for( int i = n - 2; i >= 0; i-- )
+		d[i] -= cp[i] * d[i + 1];
+}
+
+// Cyclic tridiagonal system with constant coefficients (sub, diag, super, plus the two corners
+// A[0][n-1] = sub, A[n-1][0] = super), solved with Sherman-Morrison on top of the Thomas algorithm.
+template<typename P, typename S>
+inline void solveCyclicTridiagonal( S sub, S diag, S super, std::vector<P>& d ) {
+	int n = d.size();
+	if( n < 3 ) {
+		std::vector<S> a(n, sub), b(n, diag), c(n, super);
+		solveTridiagonal( a, b, c, d );
+		return;
+	}
+	S alpha = super, beta = sub; // bottom-left and top-right corners
+	S gamma = -diag;
+	std::vector<S> a(n, sub), b(n, diag), c(n, super);
+	b[0] = diag - gamma;
+	b[n - 1] = diag - alpha * beta / gamma;
+	solveTridiagonal( a, b, c, d );
+	std::vector<S> z(n, S(0));
+	z[0] = gamma;
+	z[n - 1] = alpha;
+	solveTridiagonal( a, b, c, z );
+	P fact = (d[0] + beta * d[n - 1] / gamma) / (1 + z[0] + beta * z[n - 1] / gamma);
+	for( int i = 0; i < n; i++ )
+		d[i] -= fact * z[i];
+}
+
+// One cubic piece: p(t) = a + b t + c t^2 + d t^3 for t in [0,1]. P is any point type with
+// vector space operators over the scalar S: float, double, glm vectors of either.
+template<typename P, typename S = float>
+struct Cubic {
+	P a = P(0), b = P(0), c = P(0), d = P(0);
+	P operator()( S t ) const { return a + t * (b + t * (c + t * d)); }
+	P derivative( S t ) const { return b + t * (S(2) * c + S(3) * t * d); }
+
+	// The same curve over [t0, t1], reparameterized to [0,1].
+	Cubic sub( S t0, S t1 ) const {
+		S h = t1 - t0;
+		Cubic s;
+		s.a = (*this)( t0 );
+		s.b = h * (b + t0 * (S(2) * c + S(3) * t0 * d));
+		s.c = h * h * (c + S(3) * t0 * d);
+		s.d = h * h * h * d;
+		return s;
+	}
+	// Bezier control points; the curve lies in their convex hull.
+	void bezier( P* B ) const {
+		B[0] = a;
+		B[1] = a + b / S(3);
+		B[2] = a + (S(2) * b + c) / S(3);
+		B[3] = a + b + c + d;
+	}
+};
+typedef Cubic<vec2, float> CurveSegment;
+
+inline float distanceToSegment( const vec2& p, const vec2& a, const vec2& b ) {
+	vec2 ab = b - a;
+	float l2 = glm::dot( ab, ab );
+	float t = l2 > 0 ? glm::clamp( glm::dot( p - a, ab ) / l2, 0.f, 1.f ) : 0.f;
+	return glm::length( p - (a + t * ab) );
+}
+
+// Hermite segment between p0 and p1 with end tangents D0 and D1.
+template<typename P, typename S = float>
+inline Cubic<P,S> hermiteSegment( const P& p0, const P& p1, const P& D0, const P& D1 ) {
+	Cubic<P,S> s;
+	s.a = p0;
+	s.b = D0;
+	s.c = S(3) * (p1 - p0) - S(2) * D0 - D1;
+	s.d = S(2) * (p0 - p1) + D0 + D1;
+	return s;
+}
+
+// Right hand side of the natural spline tangent system, row i.
+template<typename P, typename S = float>
+inline P naturalRhs( const P* pts, int n, bool closed, int i ) {
+	if( closed ) return S(3) * (pts[(i + 1) % n] - pts[(i + n - 1) % n]);
+	if( i == 0 ) return S(3) * (pts[1] - pts[0]);
+	if( i == n - 1 ) return S(3) * (pts[n - 1] - pts[n - 2]);
+	return S(3) * (pts[i + 1] - pts[i - 1]);
+}
+
+// Tangents of the natural (or periodic, when closed) cubic spline through pts.
+template<typename P, typename S = float>
+inline std::vector<P> naturalTangents( const P* pts, int n, bool closed ) {
+	std::vector<P> D(n);
+	for( int i = 0; i < n; i++ ) D[i] = naturalRhs<P,S>( pts, n, closed, i );
+	if( closed ) solveCyclicTridiagonal<P,S>( 1, 4, 1, D );
+	else {
+		std::vector<S> sub(n, 1), diag(n, 4), sup(n, 1);
+		diag[0] = 2;
+		diag[n - 1] = 2;
+		solveTridiagonal( sub, diag, sup, D );
+	}
+	return D;
+}
+
+// Barycentric Lagrange interpolation (second form). The nodes are the parameters at which
+// the curve passes through each control point: 0..n-1, or Chebyshev points of the second
+// kind spread over the same range, which stay well conditioned at high n. Weights depend
+// on the nodes only, so moving a control point costs nothing here; a sample costs O(n).
+struct LagrangeBasis {
+	std::vector<double> nodes;
+	std::vector<double> weights;
+
+	LagrangeBasis() {}
+	LagrangeBasis( int n, bool chebyshev ) { build( n, chebyshev ); }
+
+	void build( int n, bool chebyshev ) {
+		nodes.resize( n );
+		weights.resize( n );
+		if( n < 2 ) {
+			nodes.assign( n, 0 );
+			weights.assign( n, 1 );
+			return;
+		}
+		const double pi = 3.14159265358979323846;
+		double logMax = std::lgamma( double(n) ) - 2 * std::lgamma( (n + 1) / 2.0 );
+		for( int i = 0; i < n; i++ ) {
+			double sign = (i % 2) ? -1 : 1;
+			if( chebyshev ) {
+				nodes[i] = (n - 1) * (1 - std::cos( pi * i / (n - 1) )) / 2;
+				weights[i] = (i == 0 || i == n - 1) ? sign / 2 : sign;
+			}
+			else {
+				// (-1)^i C(n-1, i), scaled so the largest is about 1
+				nodes[i] = i;
+				weights[i] = sign * std::exp( std::lgamma( double(n) ) - std::lgamma( i + 1.0 ) - std::lgamma( double(n - i) ) - logMax );
+			}
+		}
+	}
+
+	// invDen, if given, receives 1 / sum w_i / (x - x_i), or 0 when x is a node.
+	template<typename T> T evaluate( const T* pts, double x, double* invDen = nullptr ) const {
+		T num(0);
+		double den = 0;
+		for( int i = 0; i < nodes.size(); i++ ) {
+			double d = x - nodes[i];
+			if( d == 0 ) {
+				if( invDen ) *invDen = 0;
+				return pts[i];
+			}
+			double c = weights[i] / d;
+			num += T( c ) * pts[i];
+			den += c;
+		}
+		if( invDen ) *invDen = 1 / den;
+		return num / T( den );
+	}
+	template<typename T> T evaluate( const std::vector<T>& pts, double x, double* invDen = nullptr ) const {
+		return evaluate( pts.data(), x, invDen );
+	}
+
+	// Basis polynomial l_i(x), with invDen from evaluate() at the same x.
+	double lagrange( int i, double x, double invDen ) const {
+		if( invDen == 0 ) return x == nodes[i] ? 1 : 0;
+		return weights[i] / (x - nodes[i]) * invDen;
+	}
+};
+
+
+// Compile-time curve schemes. CurveScheme<TYPE>::segment() returns the cubic of segment k
+// from the control points around it; every local scheme is a cubic in t, so one Horner
+// evaluation serves all of them. The quadratic fits of Catmull-Rom and Overhauser are through
+// three consecutive points at x = 0, 1, 2.
+template<typename P, typename S> struct Quadratic {
+	P A, B, C;	// A x^2 + B x + C
+	Quadratic( const P& p0, const P& p1, const P& p2 )
+	: A( (p0 - S(2) * p1 + p2) / S(2) ), B( (S(-3) * p0 + S(4) * p1 - p2) / S(2) ), C( p0 ) {}
+	P slope( S x ) const { return S(2) * A * x + B; }
+	// the quadratic at x = t + shift as a cubic in t
+	Cubic<P,S> shifted( S shift ) const {
+		Cubic<P,S> s;
+		s.a = A * shift * shift + B * shift + C;
+		s.b = S(2) * A * shift + B;
+		s.c = A;
+		return s;
+	}
+};
+
+// First coordinate of a point, for the fixed Hermite tangents.
+template<typename P> inline auto& firstComponent( P& p ) { return p[0]; }
+inline float& firstComponent( float& p ) { return p; }
+inline double& firstComponent( double& p ) { return p; }
+
+template<int TYPE> struct CurveScheme {		// LINEAR, and the fallback for unknown types
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		Cubic<P,S> s;
+		s.a = p[k];
+		s.b = p[k + 1] - p[k];
+		return s;
+	}
+};
+template<> struct CurveScheme<BEZIER> {		// one cubic through the first four points, then constant
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		Cubic<P,S> s;
+		if( k != 0 ) {
+			s.a = p[3];
+			return s;
+		}
+		s.a = p[0];
+		s.b = S(3) * (p[1] - p[0]);
+		s.c = S(3) * (p[0] - S(2) * p[1] + p[2]);
+		s.d = p[3] - p[0] + S(3) * (p[1] - p[2]);
+		return s;
+	}
+};
+template<> struct CurveScheme<HERMITE> {
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		P v0(0), v1(0);
+		firstComponent( v0 ) = 120;
+		firstComponent( v1 ) = 90;
+		return hermiteSegment<P,S>( p[k], p[k + 1], v0, v1 );
+	}
+};
+template<> struct CurveScheme<CATMULL> {
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		P v0 = k > 0 ? (p[k + 1] - p[k - 1]) / S(2) : P(0);
+		P v1 = k < n - 2 ? (p[k + 2] - p[k]) / S(2) : P(0);
+		if( k <= 0 ) v0 = Quadratic<P,S>( p[k], p[k + 1], p[k + 2] ).slope( 0 );
+		else if( k >= n - 2 ) v1 = Quadratic<P,S>( p[k - 1], p[k], p[k + 1] ).slope( 2 );
+		return hermiteSegment<P,S>( p[k], p[k + 1], v0, v1 );
+	}
+};
+template<> struct CurveScheme<OVERHAUSER> {
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		P v0 = k <= 0 ? Quadratic<P,S>( p[k], p[k + 1], p[k + 2] ).slope( 0 )
+					  : Quadratic<P,S>( p[k - 1], p[k], p[k + 1] ).slope( 1 );
+		P v1 = k > n - 3 ? Quadratic<P,S>( p[k - 1], p[k], p[k + 1] ).slope( 2 )
+						 : Quadratic<P,S>( p[k], p[k + 1], p[k + 2] ).slope( 1 );
+		return hermiteSegment<P,S>( p[k], p[k + 1], v0, v1 );
+	}
+};
+template<> struct CurveScheme<OVERHAUSER2> {	// blend of the two overlapping quadratics
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		Cubic<P,S> q1 = k <= 0 ? Quadratic<P,S>( p[k], p[k + 1], p[k + 2] ).shifted( 0 )
+							   : Quadratic<P,S>( p[k - 1], p[k], p[k + 1] ).shifted( 1 );
+		Cubic<P,S> q2 = k > n - 3 ? Quadratic<P,S>( p[k - 1], p[k], p[k + 1] ).shifted( 1 )
+								  : Quadratic<P,S>( p[k], p[k + 1], p[k + 2] ).shifted( 0 );
+		// q1 + t (q2 - q1)
+		Cubic<P,S> s;
+		s.a = q1.a;
+		s.b = q1.b + q2.a - q1.a;
+		s.c = q1.c + q2.b - q1.b;
+		s.d = q2.c - q1.c;
+		return s;
+	}
+};
+template<> struct CurveScheme<BSPLINE> {	// uniform cubic B-spline, clamped to the second and second to last points
+	template<typename P, typename S> static Cubic<P,S> segment( const P* p, int n, int k ) {
+		Cubic<P,S> s;
+		if( k < 1 ) s.a = p[1];
+		else if( k > n - 3 ) s.a = p[n - 2];
+		else {
+			const P &p0 = p[k - 1], &p1 = p[k], &p2 = p[k + 1], &p3 = p[k + 2];
+			s.a = (p0 + S(4) * p1 + p2) / S(6);
+			s.b = (p2 - p0) / S(2);
+			s.c = (p0 - S(2) * p1 + p2) / S(2);
+			s.d = (p3 - p0 + S(3) * (p1 - p2)) / S(6);
+		}
+		return s;
+	}
+};
+
+// A curve of one type over a fixed set of control points, for evaluating many samples:
+// natural tangents and Lagrangian weights are prepared once, local segments are built on
+// the fly. Everything is resolved at compile time, so the sample loop inlines completely.
+// E.g. CurveEngine<CATMULL, float> over one BVH channel, CurveEngine<NATURAL, glm::dvec3, double>
+// for a long camera path.
+template<int TYPE, typename P, typename S = float>
+struct CurveEngine {
+	static constexpr bool lagrangian = TYPE == LAGLANGIAN || TYPE == LAGLANGIAN_CHEBYSHEV;
+	static constexpr bool natural = TYPE == NATURAL || TYPE == NATURAL_CLOSED;
+
+	const P* pts;
+	int n;
+	bool closed;
+	std::vector<P> tangents;
+	LagrangeBasis basis;
+
+	CurveEngine( const P* points, int count, bool isClosed ) : pts( points ), n( count ), closed( isClosed ) {
+		if constexpr( natural ) tangents = naturalTangents<P,S>( pts, n, TYPE == NATURAL_CLOSED );
+		if constexpr( lagrangian ) basis.build( n, TYPE == LAGLANGIAN_CHEBYSHEV );
+	}
+
+	Cubic<P,S> segment( int k ) const {
+		if constexpr( natural ) {
+			int k1 = (k + 1) % n;
+			return hermiteSegment<P,S>( pts[k], pts[k1], tangents[k], tangents[k1] );
+		}
+		else return CurveScheme<TYPE>::template segment<P,S>( pts, n, k );
+	}
+
+	P operator()( int k, S t ) const {
+		if constexpr( lagrangian ) return basis.evaluate( pts, double(k) + t );
+		else return segment( k )( t );
+	}
+
+	void evaluate( const int* k, const S* t, int count, P* out ) const {
+		for( int i = 0; i < count; i++ ) out[i] = (*this)( k[i], t[i] );
+	}
+};
+
+template<int TYPE, typename P, typename S>
+inline void evaluateCurve( const std::vector<P>& srcPts, bool closed, const std::vector<std::pair<int,S>>& samples, std::vector<P>& ret ) {
+	CurveEngine<TYPE,P,S> engine( srcPts.data(), srcPts.size(), closed );
+	for( auto [k, t] : samples ) ret.push_back( engine( k, t ) );
+	if( TYPE == NATURAL_CLOSED ) ret.push_back( srcPts[0] );
+}
+
+// Runtime curve type: a single dispatch per call onto the compiled engines.
+template<typename P, typename S>
+inline std::vector<P> evaluateCurve( int curveType, const std::vector<P>& srcPts, bool closed, const std::vector<std::pair<int,S>>& samples ) {
+	std::vector<P> ret;
+	ret.reserve( samples.size() + 1 );
+	switch( curveType ) {
+		case LAGLANGIAN:			evaluateCurve<LAGLANGIAN>( srcPts, closed, samples, ret ); break;
+		case LAGLANGIAN_CHEBYSHEV:	evaluateCurve<LAGLANGIAN_CHEBYSHEV>( srcPts, closed, samples, ret ); break;
+		case BEZIER:				evaluateCurve<BEZIER>( srcPts, closed, samples, ret ); break;
+		case HERMITE:				evaluateCurve<HERMITE>( srcPts, closed, samples, ret ); break;
+		case CATMULL:				evaluateCurve<CATMULL>( srcPts, closed, samples, ret ); break;
+		case OVERHAUSER:			evaluateCurve<OVERHAUSER>( srcPts, closed, samples, ret ); break;
+		case OVERHAUSER2:			evaluateCurve<OVERHAUSER2>( srcPts, closed, samples, ret ); break;
+		case BSPLINE:				evaluateCurve<BSPLINE>( srcPts, closed, samples, ret ); break;
+		case NATURAL:				evaluateCurve<NATURAL>( srcPts, closed, samples, ret ); break;
+		case NATURAL_CLOSED:		evaluateCurve<NATURAL_CLOSED>( srcPts, closed, samples, ret ); break;
+		case LINEAR:
+		default:					evaluateCurve<LINEAR>( srcPts, closed, samples, ret ); break;
+	}
+	return ret;
+}
+
+// Segment k of a local (non natural, non Lagrangian) curve type.
+template<typename P, typename S = float>
+inline Cubic<P,S> localSegment( int curveType, const P* pts, int n, int k ) {
+	switch( curveType ) {
+		case BEZIER:		return CurveScheme<BEZIER>::segment<P,S>( pts, n, k );
+		case HERMITE:		return CurveScheme<HERMITE>::segment<P,S>( pts, n, k );
+		case CATMULL:		return CurveScheme<CATMULL>::segment<P,S>( pts, n, k );
+		case OVERHAUSER:	return CurveScheme<OVERHAUSER>::segment<P,S>( pts, n, k );
+		case OVERHAUSER2:	return CurveScheme<OVERHAUSER2>::segment<P,S>( pts, n, k );
+		case BSPLINE:		return CurveScheme<BSPLINE>::segment<P,S>( pts, n, k );
+		default:			return CurveScheme<LINEAR>::segment<P,S>( pts, n, k );
+	}
+}
+
+
+// Curve with cached per-segment cubic coefficients and a fixed sampling of SEGMENT_SAMPLES
+// points per segment, so moving one control point only refits and re-samples the segments
+// it influences: up to two on either side for the local schemes, and a window of
+// NATURAL_WINDOW tangents for the natural splines (the inverse of the tangent system decays
+// by about 0.27 per row, so the truncation error at the window edge is below float precision).
+// Bezier depends on all of its control points and is rebuilt whole; the Lagrangian curves
+// are global too, but a move only adds delta * l_i(x) to each sample.
+struct Curve {
+	static const int SEGMENT_SAMPLES = 10;
+	static const int NATURAL_WINDOW = 16;
+
+	int type = LINEAR;
+	bool closed = false;
+	std::vector<vec2> pts;
+	std::vector<CurveSegment> segments;		// empty for the Lagrangian types
+	std::vector<vec2> tangents;				// natural splines only
+	std::vector<vec2> samplePts;			// SEGMENT_SAMPLES per segment at t = i/SEGMENT_SAMPLES, then the end point
+	// Segments changed since the last clearChanged(), accumulated over set/movePoint; may run
+	// past 0 or ns-1 when closed. Caches (ArcLengthTable, CurveBatch, CurveGrid) update from it;
+	// whoever drives the edits clears it once they all have.
+	int changedFirst = 0, changedLast = -1;
+
+	int nSegments() const { return pts.size() < 2 ? 0 : closed ? pts.size() : pts.size() - 1; }
+
+	void set( int curveType, const std::vector<vec2>& srcPts, bool isClosed ) {
+		type = curveType;
+		closed = isClosed;
+		pts = srcPts;
+		rebuild();
+	}
+
+	void clearChanged() {
+		changedFirst = 0;
+		changedLast = -1;
+	}
+
+	void movePoint( int i, const vec2& p ) {
+		vec2 old = pts[i];
+		pts[i] = p;
+		int n = pts.size(), ns = nSegments();
+		if( ns == 0 ) return;
+		switch( type ) {
+			case LAGLANGIAN:
+			case LAGLANGIAN_CHEBYSHEV: {
+				vec2 delta = p - old;
+				markChanged( 0, ns - 1 );
+				for( int s = 0; s < samplePts.size(); s++ )
+					samplePts[s] += delta * float( basis.lagrange( i, sampleParam( s ), sampleInvDen[s] ) );
+			} return;
+			case BEZIER:
+				if( i <= 3 ) rebuild();
+				return;
+			case NATURAL:
+			case NATURAL_CLOSED: {
+				int lo = i - NATURAL_WINDOW, hi = i + NATURAL_WINDOW;
+				if( closed && hi - lo + 1 >= n ) {
+					rebuild();
+					return;
+				}
+				if( !closed ) {
+					lo = std::max(lo, 0);
+					hi = std::min(hi, n - 1);
+				}
+				updateTangents( lo, hi );
+				refit( lo - 1, hi );
+			} break;
+			default:
+				refit( i - 2, i + 1 );
+		}
+		if( closed && i == 0 ) samplePts.back() = pts[0];
+	}
+
+	vec2 evaluate( int k, float t ) const {
+		if( segments.empty() ) return basis.evaluate( pts, k + t );
+		return segments[k]( t );
+	}
+	vec2 derivative( int k, float t ) const {
+		if( segments.empty() ) {
+			const float h = 1e-2f;
+			return (evaluate( k, t + h ) - evaluate( k, t - h )) / (2 * h);
+		}
+		return segments[k].derivative( t );
+	}
+
+	// Adaptive tessellation: each segment is halved until the piece lies within `flatness`
+	// of its chord and, when spacing > 0, is at most `spacing` long. Cubic pieces are tested
+	// on their Bezier control polygon, which bounds the curve, so nothing is missed; the
+	// Lagrangian curves are probed at the quarter points instead. Appends points (and their
+	// (segment, t) parameters if asked) to out, ending with the curve's last point.
+	void tessellate( std::vector<vec2>& out, float flatness, float spacing = 0, std::vector<std::pair<int,float>>* params = nullptr, int maxDepth = 16 ) const {
+		struct Piece { float t0, t1; int depth; };
+		int ns = nSegments();
+		std::vector<Piece> stack;
+		for( int k = 0; k < ns; k++ ) {
+			stack.push_back( { 0.f, 1.f, 0 } );
+			while( !stack.empty() ) {
+				Piece pc = stack.back();
+				stack.pop_back();
+				if( pc.depth >= maxDepth || flat( k, pc.t0, pc.t1, pc.depth, flatness, spacing ) ) {
+					out.push_back( evaluate( k, pc.t0 ) );
+					if( params ) params->push_back( { k, pc.t0 } );
+					continue;
+				}
+				float tm = (pc.t0 + pc.t1) / 2;
+				stack.push_back( { tm, pc.t1, pc.depth + 1 } );
+				stack.push_back( { pc.t0, tm, pc.depth + 1 } );
+			}
+		}
+		if( ns > 0 ) {
+			out.push_back( closed ? pts[0] : evaluate( ns - 1, 1 ) );
+			if( params ) params->push_back( { ns - 1, 1.f } );
+		}
+	}
+
+private:
+	LagrangeBasis basis;
+	std::vector<double> sampleInvDen;	// Lagrangian types, per sample
+
+	bool lagrangian() const { return type == LAGLANGIAN || type == LAGLANGIAN_CHEBYSHEV; }
+
+	bool flat( int k, float t0, float t1, int depth, float flatness, float spacing ) const {
+		float len = 0, dev = 0;
+		if( segments.empty() ) {
+			if( depth < 2 ) return false;	// high degree: don't trust a single probe
+			vec2 p0 = evaluate( k, t0 ), p1 = evaluate( k, t1 );
+			for( int j = 1; j < 4; j++ ) dev = std::max( dev, distanceToSegment( evaluate( k, t0 + (t1 - t0) * j / 4 ), p0, p1 ) );
+			len = glm::length( p1 - p0 );
+		}
+		else {
+			vec2 P[4];
+			segments[k].sub( t0, t1 ).bezier( P );
+			dev = std::max( distanceToSegment( P[1], P[0], P[3] ), distanceToSegment( P[2], P[0], P[3] ) );
+			len = glm::length( P[1] - P[0] ) + glm::length( P[2] - P[1] ) + glm::length( P[3] - P[2] );
+		}
+		return dev <= flatness && (spacing <= 0 || len <= spacing);
+	}
+
+	void markChanged( int first, int last ) {
+		if( changedLast >= changedFirst ) {
+			first = std::min( first, changedFirst );
+			last = std::max( last, changedLast );
+		}
+		int ns = nSegments();
+		if( last - first + 1 >= ns ) {
+			first = 0;
+			last = ns - 1;
+		}
+		changedFirst = first;
+		changedLast = last;
+	}
+
+	double sampleParam( int s ) const { return s / SEGMENT_SAMPLES + (s % SEGMENT_SAMPLES) / double(SEGMENT_SAMPLES); }
+
+	void rebuild() {
+		int ns = nSegments();
+		segments.clear();
+		tangents.clear();
+		samplePts.clear();
+		changedFirst = 0;
+		changedLast = ns - 1;
+		if( ns == 0 ) return;
+		samplePts.resize( ns * SEGMENT_SAMPLES + 1 );
+		if( lagrangian() ) {
+			basis.build( pts.size(), type == LAGLANGIAN_CHEBYSHEV );
+			sampleInvDen.resize( samplePts.size() );
+			for( int s = 0; s < samplePts.size(); s++ )
+				samplePts[s] = basis.evaluate( pts, sampleParam( s ), &sampleInvDen[s] );
+			return;
+		}
+		segments.resize( ns );
+		if( type == NATURAL || type == NATURAL_CLOSED ) tangents = naturalTangents( pts.data(), pts.size(), closed );
+		for( int k = 0; k < ns; k++ ) {
+			fit( k );
+			resample( k );
+		}
+		samplePts.back() = closed ? pts[0] : segments[ns - 1]( 1 );
+	}
+
+	// Segments first..last (wrapping when closed, clamped otherwise).
+	void refit( int first, int last ) {
+		int ns = nSegments();
+		if( !closed ) {
+			first = std::max(first, 0);
+			last = std::min(last, ns - 1);
+		}
+		markChanged( first, last );
+		for( int j = first; j <= last; j++ ) {
+			int k = (j % ns + ns) % ns;
+			fit( k );
+			resample( k );
+			if( !closed && k == ns - 1 ) samplePts.back() = segments[k]( 1 );
+		}
+	}
+
+	void resample( int k ) {
+		vec2* out = &samplePts[k * SEGMENT_SAMPLES];
+		for( int j = 0; j < SEGMENT_SAMPLES; j++ )
+			out[j] = segments[k]( j / float(SEGMENT_SAMPLES) );
+	}
+
+	void fit( int k ) {
+		if( type == NATURAL || type == NATURAL_CLOSED ) {
+			int k1 = (k + 1) % pts.size();
+			segments[k] = hermiteSegment( pts[k], pts[k1], tangents[k], tangents[k1] );
+		}
+		else segments[k] = localSegment( type, pts.data(), pts.size(), k );
+	}
+
+	// Re-solves tangents lo..hi (indices wrap when closed) with the tangents just outside
+	// the window held fixed.
+	void updateTangents( int lo, int hi ) {
+		int n = pts.size(), m = hi - lo + 1;
+		auto idx = [n]( int i ) { return (i % n + n) % n; };
+		std::vector<float> sub(m, 1), diag(m, 4), sup(m, 1);
+		std::vector<vec2> D(m);
+		for( int r = 0; r < m; r++ ) {
+			int i = idx( lo + r );
+			D[r] = naturalRhs( pts.data(), n, closed, i );
+			if( !closed && (i == 0 || i == n - 1) ) diag[r] = 2;
+		}
+		if( closed || lo > 0 ) D[0] -= tangents[idx( lo - 1 )];
+		if( closed || hi < n - 1 ) D[m - 1] -= tangents[idx( hi + 1 )];
+		solveTridiagonal( sub, diag, sup, D );
+		for( int r = 0; r < m; r++ ) tangents[idx( lo + r )] = D[r];
+	}
+};
+
+
+// Arc length of a Curve, for moving along it at constant speed. Each segment is split into
+// SUBDIVISIONS knots whose cumulative lengths (5-point Gauss-Legendre per piece, in double so
+// long paths keep their precision) form one sorted table. locate() finds the knot interval by
+// binary search and solves for t with a few safeguarded Newton steps; sampleUniform() walks
+// the table once for many equally spaced samples. update() re-integrates only the segments
+// the curve reports as changed.
+struct ArcLengthTable {
+	static const int SUBDIVISIONS = 4;
+	std::vector<double> knots;	// cumulative length at t = j/SUBDIVISIONS of each segment, then the total
+
+	double length() const { return knots.empty() ? 0 : knots.back(); }
+
+	void build( const Curve& curve ) {
+		int ns = curve.nSegments();
+		knots.assign( ns * SUBDIVISIONS + 1, 0 );
+		pieces.assign( ns * SUBDIVISIONS, 0 );
+		for( int k = 0; k < ns; k++ ) integrate( curve, k );
+		prefix( 0 );
+	}
+
+	void update( const Curve& curve ) {
+		int ns = curve.nSegments();
+		if( knots.size() != ns * SUBDIVISIONS + 1 ) {
+			build( curve );
+			return;
+		}
+		if( curve.changedLast < curve.changedFirst ) return;
+		for( int j = curve.changedFirst; j <= curve.changedLast; j++ ) integrate( curve, (j % ns + ns) % ns );
+		bool wraps = curve.changedFirst < 0 || curve.changedLast >= ns;
+		prefix( wraps ? 0 : curve.changedFirst );
+	}
+
+	// (segment, t) at arc length s, clamped to the curve.
+	std::pair<int,float> locate( const Curve& curve, double s ) const {
+		if( knots.size() < 2 ) return { 0, 0.f };
+		s = std::max( 0.0, std::min( s, length() ) );
+		int idx = std::upper_bound( knots.begin(), knots.end(), s ) - knots.begin() - 1;
+		return solve( curve, std::max( 0, std::min<int>( idx, knots.size() - 2 ) ), s );
+	}
+
+	vec2 pointAt( const Curve& curve, double s ) const {
+		auto [k, t] = locate( curve, s );
+		return curve.evaluate( k, t );
+	}
+
+	// count points equally spaced in arc length from start to end (inclusive), with their
+	// parameters if asked.
+	void sampleUniform( const Curve& curve, int count, std::vector<vec2>& out, std::vector<std::pair<int,float>>* params = nullptr ) const {
+		if( knots.size() < 2 || count <= 0 ) return;
+		out.reserve( out.size() + count );
+		double step = count > 1 ? length() / (count - 1) : 0;
+		int idx = 0, last = knots.size() - 2;
+		for( int i = 0; i < count; i++ ) {
+			double s = std::min( i * step, length() );
+			while( idx < last && knots[idx + 1] <= s ) idx++;
+			auto kt = solve( curve, idx, s );
+			out.push_back( curve.evaluate( kt.first, kt.second ) );
+			if( params ) params->push_back( kt );
+		}
+	}
+
+private:
+	std::vector<double> pieces;	// length of each knot interval
+
+	void integrate( const Curve& curve, int k ) {
+		for( int j = 0; j < SUBDIVISIONS; j++ )
+			pieces[k * SUBDIVISIONS + j] = gauss( curve, k, j / float(SUBDIVISIONS), (j + 1) / float(SUBDIVISIONS) );
+	}
+	// Re-accumulates knots from the start of `segment` on.
+	void prefix( int segment ) {
+		for( int i = segment * SUBDIVISIONS; i < pieces.size(); i++ )
+			knots[i + 1] = knots[i] + pieces[i];
+	}
+
+	static double gauss( const Curve& curve, int k, float t0, float t1 ) {
+		static const double x[5] = { 0, -0.5384693101056831, 0.5384693101056831, -0.9061798459386640, 0.9061798459386640 };
+		static const double w[5] = { 0.5688888888888889, 0.4786286704993665, 0.4786286704993665, 0.2369268850561891, 0.2369268850561891 };
+		double h = (t1 - t0) / 2.0, m = (t1 + t0) / 2.0, sum = 0;
+		for( int i = 0; i < 5; i++ ) sum += w[i] * glm::length( curve.derivative( k, float( m + h * x[i] ) ) );
+		return sum * h;
+	}
+
+	std::pair<int,float> solve( const Curve& curve, int idx, double s ) const {
+		int k = idx / SUBDIVISIONS;
+		float ta = (idx % SUBDIVISIONS) / float(SUBDIVISIONS), tb = ta + 1.f / SUBDIVISIONS;
+		double target = s - knots[idx], span = knots[idx + 1] - knots[idx];
+		if( span <= 0 ) return { k, ta };
+		float lo = ta, hi = tb;
+		float t = ta + float( (tb - ta) * target / span );
+		for( int it = 0; it < 8; it++ ) {
+			double f = gauss( curve, k, ta, t ) - target;
+			if( std::abs( f ) <= 1e-5 * span ) break;
+			if( f > 0 ) hi = t; else lo = t;
+			float v = glm::length( curve.derivative( k, t ) );
+			float next = v > 0 ? float( t - f / v ) : lo;
+			t = (next >= lo && next <= hi) ? next : (lo + hi) / 2;	// fall back to bisection
+		}
+		return { k, t };
+	}
+};
+
+
+// Bulk evaluation of a Curve's cubic segments into caller-provided arrays. The coefficients
+// are kept as one array per component (update() refreshes only the changed segments), so
+// evaluate() reads the 8 coefficients of each (segment, t) pair straight by index and
+// sampleSegments() evaluates a run of segments against one shared t table with Horner's rule.
+// Only sampleSegments() is a contiguous loop; evaluate() is a gather. Sorting the pairs by
+// segment first measured 3-4x slower than the gather, so use sampleSegments() when the t
+// values can be shared.
+// Cubic types only: the Lagrangian curves have no segments, leave the batch empty and go
+// through Curve::evaluate.
+struct CurveBatch {
+	int n = 0;
+	std::vector<float> ax, ay, bx, by, cx, cy, dx, dy;
+
+	void build( const Curve& curve ) {
+		n = curve.segments.size();
+		for( auto v : { &ax, &ay, &bx, &by, &cx, &cy, &dx, &dy } ) v->resize( n );
+		for( int k = 0; k < n; k++ ) copy( curve, k );
+	}
+	void update( const Curve& curve ) {
+		if( curve.segments.size() != n ) {
+			build( curve );
+			return;
+		}
+		if( n == 0 || curve.changedLast < curve.changedFirst ) return;
+		for( int j = curve.changedFirst; j <= curve.changedLast; j++ ) copy( curve, (j % n + n) % n );
+	}
+
+	// x/y[i] = segment k[i] at t[i]
+	void evaluate( const int* k, const float* t, int count, float* x, float* y ) const {
+		const float *Ax = ax.data(), *Ay = ay.data(), *Bx = bx.data(), *By = by.data();
+		const float *Cx = cx.data(), *Cy = cy.data(), *Dx = dx.data(), *Dy = dy.data();
+		for( int i = 0; i < count; i++ ) {
+			int s = k[i];
+			float u = t[i];
+			x[i] = Ax[s] + u * (Bx[s] + u * (Cx[s] + u * Dx[s]));
+			y[i] = Ay[s] + u * (By[s] + u * (Cy[s] + u * Dy[s]));
+		}
+	}
+	void evaluate( const int* k, const float* t, int count, vec2* out ) const {
+		for( int i = 0; i < count; i++ ) {
+			int s = k[i];
+			float u = t[i];
+			out[i].x = ax[s] + u * (bx[s] + u * (cx[s] + u * dx[s]));
+			out[i].y = ay[s] + u * (by[s] + u * (cy[s] + u * dy[s]));
+		}
+	}
+
+	// Segments first..first+segments-1 at the same `count` parameters t each; writes
+	// segments * count values, segment major.
+	void sampleSegments( int first, int segments, const float* t, int count, float* x, float* y ) const {
+		for( int s = first; s < first + segments; s++ ) {
+			float Ax = ax[s], Ay = ay[s], Bx = bx[s], By = by[s], Cx = cx[s], Cy = cy[s], Dx = dx[s], Dy = dy[s];
+			float* X = x + size_t(s - first) * count;
+			float* Y = y + size_t(s - first) * count;
+			for( int j = 0; j < count; j++ ) {
+				float u = t[j];
+				X[j] = Ax + u * (Bx + u * (Cx + u * Dx));
+				Y[j] = Ay + u * (By + u * (Cy + u * Dy));
+			}
+		}
+	}
+
+private:
+	void copy( const Curve& curve, int k ) {
+		const CurveSegment& s = curve.segments[k];
+		ax[k] = s.a.x; ay[k] = s.a.y;
+		bx[k] = s.b.x; by[k] = s.b.y;
+		cx[k] = s.c.x; cy[k] = s.c.y;
+		dx[k] = s.d.x; dy[k] = s.d.y;
+	}
+};
+
+
+// Uniform hashed grid over a Curve's control points and the pieces of its sample polyline
+// (samplePts[s] to samplePts[s+1]), for picking and hit-testing without scanning everything.
+// Pieces are registered in every cell their bounding box touches, or kept on a short list
+// that every query scans when that would be more than MAX_PIECE_CELLS. update() after
+// Curve::movePoint moves one control point and re-registers only the pieces of the segments
+// the curve reports as changed. Queries look at the cells within the search radius only.
+struct CurveGrid {
+	static const int MAX_PIECE_CELLS = 256;
+	float cellSize = 16;
+
+	struct Hit {
+		int segment = -1;		// -1: nothing within the radius
+		float t = 0;
+		vec2 point = vec2(0);
+		float distance = 0;
+	};
+
+	void build( const Curve& curve ) {
+		cells.clear();
+		largePieces.clear();
+		pointCell.resize( curve.pts.size() );
+		for( int i = 0; i < curve.pts.size(); i++ ) {
+			pointCell[i] = key( cellOf( curve.pts[i] ) );
+			cells[pointCell[i]].points.push_back( i );
+		}
+		int np = std::max<int>( 0, curve.samplePts.size() - 1 );
+		pieceBox.assign( np, Box{ glm::ivec2( 0 ), glm::ivec2( -1 ) } );
+		for( int s = 0; s < np; s++ ) insertPiece( curve, s );
+	}
+
+	void update( const Curve& curve, int movedPoint ) {
+		int np = std::max<int>( 0, curve.samplePts.size() - 1 );
+		if( curve.pts.size() != pointCell.size() || np != pieceBox.size() ) {
+			build( curve );
+			return;
+		}
+		long long k = key( cellOf( curve.pts[movedPoint] ) );
+		if( k != pointCell[movedPoint] ) {
+			erase( cells[pointCell[movedPoint]].points, movedPoint );
+			cells[k].points.push_back( movedPoint );
+			pointCell[movedPoint] = k;
+		}
+		if( curve.changedLast < curve.changedFirst || np == 0 ) return;
+		// a segment's samples also end the previous segment's last piece
+		int first = curve.changedFirst * Curve::SEGMENT_SAMPLES - 1;
+		int last = curve.changedLast * Curve::SEGMENT_SAMPLES + Curve::SEGMENT_SAMPLES - 1;
+		if( last - first + 1 >= np ) {
+			first = 0;
+			last = np - 1;
+		}
+		for( int j = first; j <= last; j++ ) {
+			int s = curve.closed ? (j % np + np) % np : j;
+			if( s < 0 || s >= np ) continue;
+			removePiece( s );
+			insertPiece( curve, s );
+		}
+	}
+
+	// Closest control point within radius, or -1.
+	int nearestPoint( const Curve& curve, const vec2& p, float radius ) const {
+		int best = -1;
+		float bestD = radius;
+		forCells( p, radius, [&]( const Cell& c ) {
+			for( int i : c.points ) {
+				float d = glm::length( curve.pts[i] - p );
+				if( d < bestD ) {
+					bestD = d;
+					best = i;
+				}
+			}
+		} );
+		return best;
+	}
+
+	// Closest point on the curve within radius: found on the sample polyline, then refined
+	// on the segment's cubic with a few Newton steps.
+	Hit closestOnCurve( const Curve& curve, const vec2& p, float radius ) const {
+		Hit hit;
+		int bestPiece = -1;
+		float bestD = radius;
+		forCells( p, radius, [&]( const Cell& c ) {
+			for( int s : c.pieces ) {
+				float d = distanceToSegment( p, curve.samplePts[s], curve.samplePts[s + 1] );
+				if( d < bestD ) {
+					bestD = d;
+					bestPiece = s;
+				}
+			}
+		} );
+		for( int s : largePieces ) {
+			float d = distanceToSegment( p, curve.samplePts[s], curve.samplePts[s + 1] );
+			if( d < bestD ) {
+				bestD = d;
+				bestPiece = s;
+			}
+		}
+		if( bestPiece < 0 ) return hit;
+		vec2 a = curve.samplePts[bestPiece], b = curve.samplePts[bestPiece + 1];
+		float l2 = glm::dot( b - a, b - a );
+		float u = l2 > 0 ? glm::clamp( glm::dot( p - a, b - a ) / l2, 0.f, 1.f ) : 0.f;
+		hit.segment = std::min( bestPiece / Curve::SEGMENT_SAMPLES, curve.nSegments() - 1 );
+		hit.t = std::min( 1.f, (bestPiece - hit.segment * Curve::SEGMENT_SAMPLES + u) / Curve::SEGMENT_SAMPLES );
+		// refine on the curve itself, keeping only steps that get closer
+		float bestT = hit.t, best = glm::length( curve.evaluate( hit.segment, hit.t ) - p );
+		if( !curve.segments.empty() ) {
+			const CurveSegment& seg = curve.segments[hit.segment];
+			float t = bestT;
+			for( int it = 0; it < 4; it++ ) {
+				vec2 e = seg( t ) - p, d1 = seg.derivative( t ), d2 = 2.f * seg.c + 6.f * t * seg.d;
+				float f1 = glm::dot( e, d1 ), f2 = glm::dot( d1, d1 ) + glm::dot( e, d2 );
+				if( f2 <= 0 ) break;
+				t = glm::clamp( t - f1 / f2, 0.f, 1.f );
+				float d = glm::length( seg( t ) - p );
+				if( d >= best ) break;
+				best = d;
+				bestT = t;
+			}
+		}
+		else {
+			// no derivatives for the Lagrangian types: golden section within one sample spacing
+			const float g = 0.618034f, h = 1.f / Curve::SEGMENT_SAMPLES;
+			float a = std::max( 0.f, bestT - h ), b = std::min( 1.f, bestT + h );
+			for( int it = 0; it < 16; it++ ) {
+				float t1 = b - g * (b - a), t2 = a + g * (b - a);
+				if( glm::length( curve.evaluate( hit.segment, t1 ) - p ) < glm::length( curve.evaluate( hit.segment, t2 ) - p ) ) b = t2;
+				else a = t1;
+			}
+			float d = glm::length( curve.evaluate( hit.segment, (a + b) / 2 ) - p );
+			if( d < best ) bestT = (a + b) / 2;
+		}
+		hit.t = bestT;
+		hit.point = curve.evaluate( hit.segment, hit.t );
+		hit.distance = glm::length( hit.point - p );
+		return hit;
+	}
+
+private:
+	struct Cell {
+		std::vector<int> points;
+		std::vector<int> pieces;
+	};
+	std::unordered_map<long long, Cell> cells;
+	std::vector<int> largePieces;
+	std::vector<long long> pointCell;
+	struct Box { glm::ivec2 lo, hi; };
+	std::vector<Box> pieceBox;			// cell range of each piece
+
+	glm::ivec2 cellOf( const vec2& p ) const { return glm::ivec2( cellCoord( p.x ), cellCoord( p.y ) ); }
+	int cellCoord( float v ) const {
+		float c = std::floor( v / cellSize );
+		return c > -1e9f && c < 1e9f ? int( c ) : c >= 1e9f ? 1000000000 : -1000000000;	// runaway (or NaN) samples
+	}
+	static long long key( const glm::ivec2& c ) { return (long long)((unsigned long long)(unsigned int)c.x << 32 | (unsigned int)c.y); }
+	static void erase( std::vector<int>& v, int id ) {
+		auto it = std::find( v.begin(), v.end(), id );
+		if( it == v.end() ) return;
+		*it = v.back();
+		v.pop_back();
+	}
+
+	void insertPiece( const Curve& curve, int s ) {
+		glm::ivec2 c0 = cellOf( glm::min( curve.samplePts[s], curve.samplePts[s + 1] ) );
+		glm::ivec2 c1 = cellOf( glm::max( curve.samplePts[s], curve.samplePts[s + 1] ) );
+		pieceBox[s] = Box{ c0, c1 };
+		if( double(c1.x - c0.x + 1) * (c1.y - c0.y + 1) > MAX_PIECE_CELLS ) {
+			pieceBox[s] = Box{ glm::ivec2( 0 ), glm::ivec2( -1 ) };
+			largePieces.push_back( s );
+			return;
+		}
+		for( int y = c0.y; y <= c1.y; y++ )
+			for( int x = c0.x; x <= c1.x; x++ )
+				cells[key( glm::ivec2( x, y ) )].pieces.push_back( s );
+	}
+	void removePiece( int s ) {
+		const Box& b = pieceBox[s];
+		if( b.hi.x < b.lo.x ) erase( largePieces, s );
+		for( int y = b.lo.y; y <= b.hi.y; y++ )
+			for( int x = b.lo.x; x <= b.hi.x; x++ ) {
+				auto it = cells.find( key( glm::ivec2( x, y ) ) );
+				if( it != cells.end() ) erase( it->second.pieces, s );
+			}
+	}
+
+	template<typename F> void forCells( const vec2& p, float radius, F visit ) const {
+		glm::ivec2 c0 = cellOf( p - vec2( radius ) ), c1 = cellOf( p + vec2( radius ) );
+		for( int y = c0.y; y <= c1.y; y++ )
+			for( int x = c0.x; x <= c1.x; x++ ) {
+				auto it = cells.find( key( glm::ivec2( x, y ) ) );
+				if( it != cells.end() ) visit( it->second );
+			}
+	}
+};
+
+
+// Adaptive counterpart of evaluateCurve for any curve type.
+inline std::vector<glm::vec2> tessellateCurve( int curveType, const std::vector<glm::vec2>& srcPts, bool closed, float flatness, float spacing = 0 ) {
+	Curve curve;
+	curve.set( curveType, srcPts, closed );
+	std::vector<vec2> ret;
+	curve.tessellate( ret, flatness, spacing );
+	return ret;
+}
+
+
+#endif
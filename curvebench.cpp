@@ -0,0 +1,182 @@
+//
+//  curvebench.cpp
+//  CurveInter
+//
+//  Headless benchmark of the curve types in curve.hpp.
+//  Build without JGL/GL, e.g.  g++ -std=c++17 -O2 curvebench.cpp -o curvebench
+//
+//  usage: curvebench [-f csv|json] [-o file] [-m max points] [-l max Lagrangian points] [-s samples]
+//  For every curve type and control point count (10, 100, ... up to -m, default 100000;
+//  -m 1000000 for the full range) it reports
+//    setup_us       Curve::set: segment coefficients, tangents or weights, fixed sampling
+//    samples_per_s  evaluateCurve over random (segment, t) pairs
+//    batch_per_s    CurveBatch::evaluate over the same pairs (cubic types)
+//    rebuild_us     what updateCurve does: Curve::set + CurveGrid::build
+//    drag_us        what a drag does: Curve::movePoint + CurveGrid::update,
+//                   plus CurveBatch::update for the cubic types
+//  The Lagrangian types cost O(n) per sample and are limited to -l points.
+//
+
+#include "curve.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const char* typeNames[] = {
+	"lagrangian", "linear", "bezier", "hermite", "catmull", "overhauser", "overhauser2",
+	"bspline", "natural", "natural_closed", "lagrangian_chebyshev"
+};
+
+struct CurveStats {
+	int type = 0;
+	int points = 0;
+	double setupUs = 0;
+	double samplesPerSec = 0;
+	double batchPerSec = 0;
+	double rebuildUs = 0;
+	double dragUs = 0;
+};
+
+double seconds(Clock::time_point a, Clock::time_point b) {
+	return std::chrono::duration<double>(b - a).count();
+}
+
+// Seconds per call, repeating f until at least minSec have passed.
+template<typename F> double timeIt(F f, double minSec = 0.05) {
+	int reps = 0;
+	auto t0 = Clock::now();
+	double sec = 0;
+	do {
+		f();
+		reps++;
+		sec = seconds(t0, Clock::now());
+	} while( sec < minSec );
+	return sec / reps;
+}
+
+// A random walk, so segments have screen-like lengths whatever the count.
+std::vector<glm::vec2> makePoints(int n, std::mt19937& rng) {
+	std::uniform_real_distribution<float> step(-8.f, 8.f);
+	std::vector<glm::vec2> pts(n);
+	pts[0] = glm::vec2(500);
+	for( int i = 1; i < n; i++ ) pts[i] = pts[i-1] + glm::vec2(10 + step(rng), step(rng) * 4);
+	return pts;
+}
+
+CurveStats benchCurve(int type, int n, int samples, std::mt19937& rng) {
+	CurveStats st;
+	st.type = type;
+	st.points = n;
+	bool closed = type == NATURAL_CLOSED;
+	std::vector<glm::vec2> pts = makePoints(n, rng);
+
+	Curve curve;
+	st.setupUs = timeIt([&]() { curve.set(type, pts, closed); }) * 1e6;
+
+	int ns = curve.nSegments();
+	if( type == LAGLANGIAN || type == LAGLANGIAN_CHEBYSHEV ) samples = std::max(1000, std::min(samples, 20000000 / n));
+	std::vector<std::pair<int,float>> sampleT(samples);
+	std::vector<int> k(samples);
+	std::vector<float> t(samples), x(samples), y(samples);
+	std::uniform_real_distribution<float> u(0.f, 1.f);
+	for( int i = 0; i < samples; i++ ) {
+		k[i] = rng() % ns;
+		t[i] = u(rng);
+		sampleT[i] = { k[i], t[i] };
+	}
+	volatile float sink = 0;
+	double sec = timeIt([&]() { sink = sink + evaluateCurve(type, pts, closed, sampleT).back().x; });
+	st.samplesPerSec = samples / sec;
+	CurveBatch batch;
+	if( !curve.segments.empty() ) {
+		batch.build(curve);
+		sec = timeIt([&]() { batch.evaluate(k.data(), t.data(), samples, x.data(), y.data()); sink = sink + x[0]; });
+		st.batchPerSec = samples / sec;
+	}
+
+	CurveGrid grid;
+	st.rebuildUs = timeIt([&]() {
+		curve.set(type, pts, closed);
+		grid.build(curve);
+		curve.clearChanged();
+	}) * 1e6;
+
+	std::normal_distribution<float> jitter(0.f, 3.f);
+	st.dragUs = timeIt([&]() {
+		int i = rng() % n;
+		pts[i] += glm::vec2(jitter(rng), jitter(rng));
+		curve.movePoint(i, pts[i]);
+		grid.update(curve, i);
+		batch.update(curve);
+		curve.clearChanged();
+	}) * 1e6;
+	return st;
+}
+
+void writeCSV(FILE* fp, const std::vector<CurveStats>& stats) {
+	fprintf(fp, "type,points,setup_us,samples_per_s,batch_per_s,rebuild_us,drag_us\n");
+	for( auto& st : stats )
+		fprintf(fp, "%s,%d,%.3f,%.0f,%.0f,%.3f,%.3f\n", typeNames[st.type], st.points,
+				st.setupUs, st.samplesPerSec, st.batchPerSec, st.rebuildUs, st.dragUs);
+}
+
+void writeJSON(FILE* fp, const std::vector<CurveStats>& stats) {
+	fprintf(fp, "[\n");
+	for( int i = 0; i < stats.size(); i++ ) {
+		const CurveStats& st = stats[i];
+		fprintf(fp, "  {\"type\": \"%s\", \"points\": %d, \"setup_us\": %.3f, \"samples_per_s\": %.0f, "
+				"\"batch_per_s\": %.0f, \"rebuild_us\": %.3f, \"drag_us\": %.3f}%s\n",
+				typeNames[st.type], st.points, st.setupUs, st.samplesPerSec, st.batchPerSec,
+				st.rebuildUs, st.dragUs, i + 1 < stats.size() ? "," : "");
+	}
+	fprintf(fp, "]\n");
+}
+
+int main(int argc, const char * argv[]) {
+	std::string format = "csv", outFile;
+	int maxPoints = 100000;
+	int maxLagrange = 1000;
+	int samples = 1000000;
+	for( int i = 1; i < argc; i++ ) {
+		std::string a = argv[i];
+		if( a == "-f" && i+1 < argc ) format = argv[++i];
+		else if( a == "-o" && i+1 < argc ) outFile = argv[++i];
+		else if( a == "-m" && i+1 < argc ) maxPoints = std::max(10, atoi(argv[++i]));
+		else if( a == "-l" && i+1 < argc ) maxLagrange = std::max(10, atoi(argv[++i]));
+		else if( a == "-s" && i+1 < argc ) samples = std::max(1, atoi(argv[++i]));
+		else {
+			fprintf(stderr, "usage: %s [-f csv|json] [-o file] [-m max points] [-l max Lagrangian points] [-s samples]\n", argv[0]);
+			return 1;
+		}
+	}
+	if( format != "csv" && format != "json" ) {
+		fprintf(stderr, "unknown format %s\n", format.c_str());
+		return 1;
+	}
+
+	std::mt19937 rng(11);
+	std::vector<CurveStats> stats;
+	for( int type = LAGLANGIAN; type <= LAGLANGIAN_CHEBYSHEV; type++ ) {
+		bool lagrangian = type == LAGLANGIAN || type == LAGLANGIAN_CHEBYSHEV;
+		for( int n = 10; n <= maxPoints; n *= 10 ) {
+			if( lagrangian && n > maxLagrange ) break;
+			stats.push_back(benchCurve(type, n, samples, rng));
+			fprintf(stderr, "%-22s %8d points  setup %10.1f us  %6.1f M samples/s  drag %8.2f us\n",
+					typeNames[type], n, stats.back().setupUs, stats.back().samplesPerSec / 1e6, stats.back().dragUs);
+		}
+	}
+
+	FILE* fp = outFile.empty() ? stdout : fopen(outFile.c_str(), "w");
+	if( !fp ) {
+		fprintf(stderr, "can't open %s\n", outFile.c_str());
+		return 1;
+	}
+	if( format == "json" ) writeJSON(fp, stats);
+	else writeCSV(fp, stats);
+	if( fp != stdout ) fclose(fp);
+	return 0;
+}
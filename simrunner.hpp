@@ -0,0 +1,149 @@
+#ifndef __SIMRUNNER_HPP__
+#define __SIMRUNNER_HPP__
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+// Runs a simulation step on a worker thread so a slow step no longer stalls drawing.
+// The UI thread asks for steps with request() (from AnimView::frameFunction); the worker
+// runs them, captures the state the renderer needs into a snapshot and publishes it through
+// a triple buffer; renderFunction draws latest(). Neither side ever waits for the other.
+
+// Single producer, single consumer triple buffer: the writer fills back() and publishes it,
+// the reader takes the newest published slot. Lock free, one atomic exchange per side.
+template<typename T>
+struct TripleBuffer {
+	T& back() { return slots[backIdx]; }
+
+	// Returns false if the snapshot it replaces was never taken by the reader.
+	bool publish() {
+		int old = middle.exchange( backIdx | FRESH, std::memory_order_acq_rel );
+		backIdx = old & INDEX;
+		return !(old & FRESH);
+	}
+	// Takes the newest published snapshot, if there is one since the last take().
+	bool take() {
+		if( !(middle.load( std::memory_order_acquire ) & FRESH) ) return false;
+		frontIdx = middle.exchange( frontIdx, std::memory_order_acq_rel ) & INDEX;
+		return true;
+	}
+	const T& front() const { return slots[frontIdx]; }
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+	T slots[3];
+	int backIdx = 0, frontIdx = 1;
+	std::atomic<int> middle { 2 };
+};
+
+struct SimStats {
+	long long steps = 0;	// steps run
+	long long late = 0;		// steps run after a newer request had already arrived
+	long long skipped = 0;	// requests dropped because the backlog exceeded maxBacklog
+	long long unseen = 0;	// snapshots replaced before the renderer took them
+	double meanStepMs = 0;
+	double maxStepMs = 0;
+};
+
+template<typename Snapshot>
+struct SimRunner {
+	int maxBacklog = 2;		// steps run at most per wake-up when the worker falls behind
+
+	~SimRunner() { stop(); }
+
+	// step(arg) advances the simulation, capture(snapshot) copies out what render needs.
+	// Both run on the worker thread only.
+	void start( std::function<void(float)> stepFn, std::function<void(Snapshot&)> captureFn ) {
+		stop();
+		step = stepFn;
+		capture = captureFn;
+		pending = 0;
+		running = true;
+		worker = std::thread( [this]() { run(); } );
+	}
+	void stop() {
+		if( !worker.joinable() ) return;
+		{
+			std::lock_guard<std::mutex> lock( mtx );
+			running = false;
+		}
+		cv.notify_one();
+		worker.join();
+	}
+
+	// UI thread: one more step with this argument (the frame's dt, or the playback time).
+	void request( float arg ) {
+		{
+			std::lock_guard<std::mutex> lock( mtx );
+			lastArg = arg;
+			pending++;
+		}
+		cv.notify_one();
+	}
+
+	// Render thread: the newest consistent snapshot, or nullptr before the first one.
+	const Snapshot* latest() {
+		if( buffer.take() ) hasFront = true;
+		return hasFront ? &buffer.front() : nullptr;
+	}
+
+	SimStats stats() const {
+		SimStats s;
+		s.steps = steps;
+		s.late = late;
+		s.skipped = skipped;
+		s.unseen = unseen;
+		s.meanStepMs = s.steps > 0 ? stepMicros / 1e3 / s.steps : 0;
+		s.maxStepMs = maxStepMicros / 1e3;
+		return s;
+	}
+
+private:
+	std::function<void(float)> step;
+	std::function<void(Snapshot&)> capture;
+	TripleBuffer<Snapshot> buffer;
+	bool hasFront = false;
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool running = false;
+	int pending = 0;
+	float lastArg = 0;
+	std::atomic<long long> steps { 0 }, late { 0 }, skipped { 0 }, unseen { 0 };
+	std::atomic<long long> stepMicros { 0 }, maxStepMicros { 0 };
+
+	void run() {
+		for( ;; ) {
+			int n;
+			float arg;
+			{
+				std::unique_lock<std::mutex> lock( mtx );
+				cv.wait( lock, [this]() { return !running || pending > 0; } );
+				if( !running ) return;
+				n = pending;
+				arg = lastArg;
+				pending = 0;
+			}
+			int count = std::min( n, std::max( 1, maxBacklog ) );
+			skipped += n - count;
+			late += count - 1;
+			for( int i = 0; i < count; i++ ) {
+				auto t0 = std::chrono::steady_clock::now();
+				step( arg );
+				long long us = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - t0 ).count();
+				stepMicros += us;
+				if( us > maxStepMicros ) maxStepMicros = us;
+				steps++;
+			}
+			capture( buffer.back() );
+			if( !buffer.publish() ) unseen++;
+		}
+	}
+};
+
+#endif